@@ -13,3 +13,25 @@ V = @
 # tools that the 6.828 make system looks for by default).
 #
 # GCCPREFIX=''
+
+# Sizes of the e100 descriptor rings, if not the defaults: transmit
+# command blocks, and receive frame descriptors (a page each).
+#
+# E100_CBL=256
+# E100_RFA=128
+
+# Set to 1 to have the network server map the e100 rings into itself and
+# move frames through them, trapping only to ring the doorbell.
+#
+# NS_RING=1
+
+# Set to 1 to run the network server as a single env, taking frames off
+# the NIC and running the lwIP timers from its own threads instead of
+# hearing from the input and timer envs.
+#
+# NS_SINGLE=1
+
+# Most files one environment may have open in the file server at once,
+# so a runaway client cannot take all 1024 entries from the others.
+#
+# FS_CLIENTOPEN=256
@@ -1,3 +1,4 @@
+#include <inc/x86.h>
 #include <inc/string.h>
 
 #include "fs.h"
@@ -7,9 +8,39 @@
 struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
 
+// Summary of the bitmap: free blocks per bitmap block, and per chunk
+// of CHUNKBITS blocks, so allocation skips full stretches of the disk
+// without reading their bitmap words.
+#define CHUNKBITS	1024
+#define CHUNKWORDS	(CHUNKBITS / 32)
+#define BMCHUNKS	(BLKBITSIZE / CHUNKBITS)	// chunks per bitmap block
+static uint32_t bmfree[DISKSIZE / BLKSIZE / BLKBITSIZE];
+static uint16_t chunkfree[DISKSIZE / BLKSIZE / CHUNKBITS];
+
 void file_flush(struct File *f);
 bool block_is_free(uint32_t blockno);
 
+// The server's worker threads take turns in the file system under one
+// lock.  It is only given up while a thread waits for a file data block
+// to come in from disk (read_data_block), so requests that hit in the
+// block cache go on being served meanwhile.
+static volatile uint32_t fs_locked;
+
+void
+fs_lock(void)
+{
+	while (fs_locked)
+		thread_wait(&fs_locked, 1, (uint32_t) ~0);
+	fs_locked = 1;
+}
+
+void
+fs_unlock(void)
+{
+	fs_locked = 0;
+	thread_wakeup(&fs_locked);
+}
+
 // Return the virtual address of this disk block.
 char*
 diskaddr(uint32_t blockno)
@@ -54,6 +85,173 @@ map_block(uint32_t blockno)
 	return sys_page_alloc(0, diskaddr(blockno), PTE_U|PTE_P|PTE_W);
 }
 
+// The file system lives on one disk, or is striped or mirrored across
+// several (see FS_DISK_*).  fsdisk lists the member IDE disks in order.
+static int fsdisk[FS_MAXDISKS];
+static int nfsdisk = 1;
+static int nchannel = 1;	// IDE channels the members are on
+static uint32_t diskmode = FS_DISK_SINGLE;
+static uint32_t stripe;
+static uint32_t mirror_hand;
+
+// Find where block 'blockno' lives: block *pbno of disk *pd.  Mirrored,
+// any member will do; take the one with the fewest commands pending,
+// passing over those on the channels in the 'avoid' mask if possible.
+static void
+disk_locate(uint32_t blockno, uint32_t avoid, int *pd, uint32_t *pbno)
+{
+	int i, k, best;
+	uint32_t unit;
+
+	switch (diskmode) {
+	case FS_DISK_STRIPE:
+		unit = blockno / stripe;
+		*pd = fsdisk[unit % nfsdisk];
+		*pbno = (unit / nfsdisk) * stripe + blockno % stripe;
+		return;
+
+	case FS_DISK_MIRROR:
+		// Start from a different member each time to share out ties
+		best = -1;
+		for (k = 0; k < nfsdisk; k++) {
+			i = (mirror_hand + k) % nfsdisk;
+			if (avoid & (1 << ide_channel(fsdisk[i])))
+				continue;
+			if (best < 0 || ide_pending(fsdisk[i]) < ide_pending(fsdisk[best]))
+				best = i;
+		}
+		if (best < 0)
+			best = mirror_hand % nfsdisk;
+		mirror_hand++;
+		*pd = fsdisk[best];
+		*pbno = blockno;
+		return;
+
+	default:
+		*pd = fsdisk[0];
+		*pbno = blockno;
+	}
+}
+
+// How many of the n blocks from blockno on lie one after another on
+// the same disk.
+static uint32_t
+disk_run(uint32_t blockno, uint32_t n)
+{
+	if (diskmode == FS_DISK_STRIPE)
+		return MIN(n, stripe - blockno % stripe);
+	return n;
+}
+
+int
+disk_read(uint32_t blockno, void *va)
+{
+	int d;
+	uint32_t bno;
+
+	disk_locate(blockno, 0, &d, &bno);
+	return ide_read(d, bno * BLKSECTS, va, BLKSECTS);
+}
+
+int
+disk_write(uint32_t blockno, const void *va)
+{
+	int i, d, r;
+	uint32_t bno;
+
+	if (diskmode != FS_DISK_MIRROR) {
+		disk_locate(blockno, 0, &d, &bno);
+		return ide_write(d, bno * BLKSECTS, va, BLKSECTS);
+	}
+	for (i = 0; i < nfsdisk; i++)
+		if ((r = ide_write(fsdisk[i], blockno * BLKSECTS, va, BLKSECTS)) < 0)
+			return r;
+	return 0;
+}
+
+// Read the n blocks from blockno on into the pages from va on.  The run
+// goes out as one command per stretch that is contiguous on a disk, with
+// a command outstanding on every channel at once, so the disks seek and
+// transfer side by side.  Mirrored runs are split between the channels.
+static int
+disk_read_run(uint32_t blockno, uint32_t n, char *va)
+{
+	struct {
+		int d;
+		uint32_t bno, n;
+		char *va;
+	} cmd[IDE_NCHANNEL], t;
+	uint32_t chans, max, k;
+	int i, ncmd, d, r, rr;
+
+	r = 0;
+	while (n > 0) {
+		max = ROUNDUP(n, nchannel) / nchannel;
+		if (max > 256 / BLKSECTS)
+			max = 256 / BLKSECTS;
+		chans = 0;
+		for (ncmd = 0; n > 0 && ncmd < IDE_NCHANNEL; ncmd++) {
+			disk_locate(blockno, chans, &d, &cmd[ncmd].bno);
+			if (chans & (1 << ide_channel(d)))
+				break;
+			chans |= 1 << ide_channel(d);
+			k = MIN(disk_run(blockno, n), max);
+			cmd[ncmd].d = d;
+			cmd[ncmd].n = k;
+			cmd[ncmd].va = va;
+			blockno += k;
+			n -= k;
+			va += k * BLKSIZE;
+		}
+
+		// Take the channels in order, so that two threads issuing
+		// runs never each hold the channel the other is waiting for.
+		if (ncmd == 2 && ide_channel(cmd[0].d) > ide_channel(cmd[1].d)) {
+			t = cmd[0];
+			cmd[0] = cmd[1];
+			cmd[1] = t;
+		}
+		for (i = 0; i < ncmd; i++)
+			ide_start(cmd[i].d, cmd[i].bno * BLKSECTS, cmd[i].n * BLKSECTS, 0);
+		for (i = 0; i < ncmd; i++)
+			if ((rr = ide_finish(cmd[i].d, cmd[i].va, cmd[i].n * BLKSECTS, 0)) < 0)
+				r = rr;
+	}
+	return r;
+}
+
+// Find the other member disks of a striped or mirrored file system.
+static void
+disk_configure(void)
+{
+	int d, i;
+	uint32_t chans;
+
+	if (super->s_diskmode == FS_DISK_SINGLE || super->s_ndisks <= 1)
+		return;
+	if ((super->s_diskmode != FS_DISK_STRIPE && super->s_diskmode != FS_DISK_MIRROR)
+	    || super->s_ndisks > FS_MAXDISKS)
+		panic("bad disk layout %d/%d", super->s_diskmode, super->s_ndisks);
+	// The superblock must come first on disk 0 of a stripe
+	if (super->s_diskmode == FS_DISK_STRIPE && super->s_stripe < 2)
+		panic("bad stripe unit %d", super->s_stripe);
+
+	for (d = fsdisk[0] + 1; d < IDE_NDISK && nfsdisk < super->s_ndisks; d++)
+		if (ide_probe(d))
+			fsdisk[nfsdisk++] = d;
+	if (nfsdisk < super->s_ndisks)
+		panic("file system spans %d disks, found %d", super->s_ndisks, nfsdisk);
+
+	chans = 0;
+	for (i = 0; i < nfsdisk; i++)
+		chans |= 1 << ide_channel(fsdisk[i]);
+	nchannel = (chans & 1) + ((chans >> 1) & 1);
+	stripe = super->s_stripe;
+	diskmode = super->s_diskmode;
+	cprintf("fs: %s across %d disks\n",
+		diskmode == FS_DISK_STRIPE ? "striped" : "mirrored", nfsdisk);
+}
+
 // Make sure a particular disk block is loaded into memory.
 // Returns 0 on success, or a negative error code on error.
 // 
@@ -81,9 +279,9 @@ read_block(uint32_t blockno, char **blk)
 	if ((r = sys_page_alloc(0, addr, PTE_U | PTE_P | PTE_W)) < 0)
 		return r;
 	
-	if ((r = ide_read(blockno * BLKSECTS, addr, BLKSECTS)) < 0)
+	if ((r = disk_read(blockno, addr)) < 0)
 		return r;
-	/* ide_read() has dirtied the page, so we remap it */
+	/* disk_read() has dirtied the page, so we remap it */
 	sys_page_map(0, addr, 0, addr, PTE_U | PTE_P | PTE_W);
 done:
 	if (blk)
@@ -91,6 +289,51 @@ done:
 	return 0;
 }
 
+// Pages that data blocks are read into before they enter the cache.
+#define READVA		0x0fe00000
+#define NREADVA		16
+static volatile uint32_t readva_used;
+
+// Like read_block, but give up the fs lock while the disk is busy.
+// The block is read into a page of its own and only put in the cache
+// once the lock is back, unless someone else cached it in the meantime.
+// The caller must check that the block still belongs to it: the file
+// may have changed while the lock was dropped.
+static int
+read_data_block(uint32_t blockno, char **blk)
+{
+	int r, i;
+	char *addr, *va;
+
+	addr = diskaddr(blockno);
+	if (block_is_mapped(blockno))
+		goto done;
+
+	while (readva_used == (1 << NREADVA) - 1)
+		thread_wait(&readva_used, (1 << NREADVA) - 1, (uint32_t) ~0);
+	i = bsf(~readva_used);
+	readva_used |= 1 << i;
+	va = (char *) (READVA + i * PGSIZE);
+
+	if ((r = sys_page_alloc(0, va, PTE_U | PTE_P | PTE_W)) < 0)
+		goto out;
+	fs_unlock();
+	r = disk_read(blockno, va);
+	fs_lock();
+	if (r >= 0 && !block_is_mapped(blockno))
+		r = sys_page_map(0, va, 0, addr, PTE_U | PTE_P | PTE_W);
+	sys_page_unmap(0, va);
+out:
+	readva_used &= ~(1 << i);
+	thread_wakeup(&readva_used);
+	if (r < 0)
+		return r;
+done:
+	if (blk)
+		*blk = addr;
+	return 0;
+}
+
 // Copy the current contents of the block out to disk.
 // Then clear the PTE_D bit using sys_page_map.
 void
@@ -103,7 +346,7 @@ write_block(uint32_t blockno)
 	
 	addr = diskaddr(blockno);
 
-	if (ide_write(blockno * BLKSECTS, addr, BLKSECTS) < 0)
+	if (disk_write(blockno, addr) < 0)
 		panic("ATA write error");
 	if (debug)
 		cprintf("write block %x to disk\n", blockno);
@@ -156,58 +399,111 @@ free_block(uint32_t blockno)
 	// Blockno zero is the null pointer of block numbers.
 	if (blockno == 0)
 		panic("attempt to free zero block");
+	// A second free would count the block twice in the summaries
+	if (block_is_free(blockno))
+		panic("free_block: block %08x is already free", blockno);
+	if (super->s_njournal && journal_free(blockno))
+		return;
 	bitmap[blockno/32] |= 1<<(blockno%32);
+	bmfree[blockno / BLKBITSIZE]++;
+	chunkfree[blockno / CHUNKBITS]++;
 }
 
-// Search the bitmap for a free block and allocate it.
+// Mark a free block in use in the bitmap
+static void
+use_block(uint32_t blockno)
+{
+	bitmap[blockno/32] &= ~(1<<(blockno%32));
+	bmfree[blockno / BLKBITSIZE]--;
+	chunkfree[blockno / CHUNKBITS]--;
+}
+
+// Search the bitmap for a free block and allocate it, trying 'goal'
+// first, then the blocks after it, then wrapping around to block 0.
 // 
 // Return block number allocated on success,
 // -E_NO_DISK if we are out of blocks.
 int
-alloc_block_num(void)
+alloc_block_num(uint32_t goal)
 {
-	int i, j;
-	/* Try to find a element of bitmap that indicates containing free blocks
-	 * We stride in 8 bits for speedup
-	 */
-	for (i = 0; i < super->s_nblocks / 32; i++) {
-		if (!bitmap[i])
+	uint32_t n, c, w, wend, nchunk, mask, bno;
+
+	if (goal >= super->s_nblocks)
+		goal = 0;
+	nchunk = ROUNDUP(super->s_nblocks, CHUNKBITS) / CHUNKBITS;
+
+	// Visit goal's chunk first starting at goal, the other chunks in
+	// order, and goal's chunk again in full in case the only free
+	// blocks left are just before goal.
+	for (n = 0; n <= nchunk; n++) {
+		c = (goal / CHUNKBITS + n) % nchunk;
+		if (bmfree[c / BMCHUNKS] == 0) {
+			// Skip the rest of this bitmap block's chunks
+			n += MIN(BMCHUNKS - 1 - c % BMCHUNKS, nchunk - 1 - c);
+			continue;
+		}
+		if (chunkfree[c] == 0)
 			continue;
-		goto found;
+		w = c * CHUNKWORDS;
+		wend = w + CHUNKWORDS;
+		if (n == 0)
+			w = goal / 32;
+		for (; w < wend; w++) {
+			mask = bitmap[w];
+			if (n == 0 && w == goal / 32)
+				mask &= ~0U << (goal % 32);
+			if (mask) {
+				bno = w * 32 + bsf(mask);
+				use_block(bno);
+				return bno;
+			}
+		}
 	}
 	/* Out of blocks */
 	return -E_NO_DISK;
-found:
-	for (j = 0; j < 32; j++)
-		if (bitmap[i] & (1 << j))
-			break;
+}
 
-	bitmap[i] &= ~(1 << j); /* Mark it in use */
+// Write out any bitmap blocks changed since they were last written.
+// Allocation only changes the bitmap in memory; it reaches the disk
+// here, ahead of the file metadata that points at the new blocks.
+void
+flush_bitmap(void)
+{
+	uint32_t i;
 
-	return i * 32 + j;
+	for (i = 0; i * BLKBITSIZE < super->s_nblocks; i++)
+		if (block_is_dirty(2 + i))
+			write_block(2 + i);
 }
 
-// Allocate a block -- first find a free block in the bitmap,
-// then map it into memory.
+// Allocate a block -- find a free block in the bitmap, as close
+// after 'goal' as possible, then map it into memory.
+// The bitmap change is written out later by flush_bitmap.
 //
 // Return block number on success
 // -E_NO_DISK if we are out of blocks
 int
-alloc_block(void)
+alloc_block_near(uint32_t goal)
 {
-
 	int r, bno;
-	if ((bno = r = alloc_block_num()) < 0)
+
+	if ((bno = r = alloc_block_num(goal)) < 0)
 		return r;
 
 	if ((r = map_block(bno)) < 0) {
 		free_block(bno);
 		return r;
 	}
-	write_block(2 + bno / BLKBITSIZE); /* Flush the changed bitmap block */
 	return bno;
 }
 
+// Allocate any free block and map it into memory.
+int
+alloc_block(void)
+{
+	return alloc_block_near(0);
+}
+
 // Read and validate the file system super-block.
 void
 read_super(void)
@@ -219,12 +515,14 @@ read_super(void)
 		panic("cannot read superblock: %e", r);
 
 	super = (struct Super*) blk;
-	if (super->s_magic != FS_MAGIC)
+	if (super->s_magic != FS_MAGIC && super->s_magic != FS_MAGIC_EXT)
 		panic("bad file system magic number");
 
 	if (super->s_nblocks > DISKSIZE/BLKSIZE)
 		panic("file system is too large");
 
+	disk_configure();
+
 	//cprintf("superblock is good\n");
 }
 
@@ -244,6 +542,13 @@ read_bitmap(void)
 		// Make sure all bitmap blocks are marked in-use
 		assert(!block_is_free(2+i));
 	}
+
+	// Build the free-count summary
+	for (i = 0; i < super->s_nblocks; i++)
+		if (block_is_free(i)) {
+			bmfree[i / BLKBITSIZE]++;
+			chunkfree[i / CHUNKBITS]++;
+		}
 	
 	// Make sure the reserved and root blocks are marked in-use.
 	assert(!block_is_free(0));
@@ -251,6 +556,15 @@ read_bitmap(void)
 	assert(bitmap);
 }
 
+// Largest file size the mounted file system can hold.
+off_t
+fs_maxfilesize(void)
+{
+	if (super->s_magic == FS_MAGIC_EXT)
+		return MAXEXTFILESIZE;
+	return MAXFILESIZE;
+}
+
 // Initialize the file system
 void
 fs_init(void)
@@ -258,15 +572,229 @@ fs_init(void)
 	static_assert(sizeof(struct File) == 256);
 
 	// Find a JOS disk.  Use the second IDE disk (number 1) if available.
-	if (ide_probe_disk1())
-		ide_set_disk(1);
-	else
-		ide_set_disk(0);
+	// A striped or mirrored file system goes on from there (read_super).
+	fsdisk[0] = ide_probe(1) ? 1 : 0;
 	
 	read_super();
+	if (super->s_njournal)
+		journal_init();
 	read_bitmap();
 }
 
+// Disk block to start looking from when a file gets its first block:
+// the one holding the File itself, so small files land near their
+// directory.
+static uint32_t
+file_home_block(struct File *f)
+{
+	if ((uintptr_t) f < DISKMAP || (uintptr_t) f >= DISKMAP + DISKSIZE)
+		return 0;
+	return ((uintptr_t) f - DISKMAP) / BLKSIZE;
+}
+
+// Allocate a block for an extent tree and clear it.  A block that was
+// freed stays in the cache with its old contents, and stale index or
+// extent entries would point into other files.
+static int
+extent_alloc_tree(void)
+{
+	int bno;
+
+	if ((bno = alloc_block()) < 0)
+		return bno;
+	journal_meta(bno);
+	memset(diskaddr(bno), 0, BLKSIZE);
+	return bno;
+}
+
+// Find the slot holding the k'th extent of file 'f'.
+// The first NEXTENT extents live in the File itself; the rest live in
+// leaf blocks of EXTPERBLK extents each, listed by the index block
+// f->f_exttree.  When 'alloc' is set, allocate the index and leaf
+// blocks as needed.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NOT_FOUND if a tree block is missing and alloc was 0.
+//	-E_NO_DISK if the file has too many extents or the disk is full.
+static int
+extent_slot(struct File *f, uint32_t k, struct Extent **pext, bool alloc)
+{
+	int r;
+	uint32_t *idx;
+	struct Extent *leaf;
+
+	if (k < NEXTENT) {
+		*pext = &f->f_extent[k];
+		return 0;
+	}
+	k -= NEXTENT;
+	if (k >= NEXTIDX * EXTPERBLK)
+		return -E_NO_DISK;
+
+	if (f->f_exttree == 0) {
+		if (!alloc)
+			return -E_NOT_FOUND;
+		if ((r = extent_alloc_tree()) < 0)
+			return r;
+		f->f_exttree = r;
+	}
+	journal_meta(f->f_exttree);
+	if ((r = read_block(f->f_exttree, (char **) &idx)) < 0)
+		return r;
+	if (idx[k / EXTPERBLK] == 0) {
+		if (!alloc)
+			return -E_NOT_FOUND;
+		if ((r = extent_alloc_tree()) < 0)
+			return r;
+		idx[k / EXTPERBLK] = r;
+	}
+	journal_meta(idx[k / EXTPERBLK]);
+	if ((r = read_block(idx[k / EXTPERBLK], (char **) &leaf)) < 0)
+		return r;
+	*pext = &leaf[k % EXTPERBLK];
+	return 0;
+}
+
+// The extent the last lookup landed in.  Only used as a starting guess,
+// so it need not be invalidated when files change.
+static struct File *ext_hint_file;
+static uint32_t ext_hint;
+
+// Set '*diskbno' to the disk block holding the 'filebno'th block of the
+// extent-mapped file 'f'.  Binary search over the extents, but look at
+// the extent we found last time, and the one after it, first: sequential
+// access rarely needs more than that.
+static int
+extent_lookup(struct File *f, uint32_t filebno, uint32_t *diskbno)
+{
+	int r;
+	uint32_t lo, hi, mid;
+	struct Extent *e;
+
+	if (filebno >= f->f_nblocks)
+		return -E_NOT_FOUND;
+
+	// Invariant: extent lo starts at or before filebno,
+	// and filebno lies before the start of extent hi.
+	lo = 0;
+	hi = f->f_nextent;
+	if (ext_hint_file == f && ext_hint < hi) {
+		if ((r = extent_slot(f, ext_hint, &e, 0)) < 0)
+			return r;
+		if (e->e_fileblk > filebno)
+			hi = ext_hint;
+		else {
+			lo = ext_hint;
+			if (lo + 1 < hi) {
+				if ((r = extent_slot(f, lo + 1, &e, 0)) < 0)
+					return r;
+				if (e->e_fileblk > filebno)
+					hi = lo + 1;
+			}
+		}
+	}
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if ((r = extent_slot(f, mid, &e, 0)) < 0)
+			return r;
+		if (e->e_fileblk <= filebno)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if ((r = extent_slot(f, lo, &e, 0)) < 0)
+		return r;
+	ext_hint_file = f;
+	ext_hint = lo;
+	*diskbno = e->e_diskblk + (filebno - e->e_fileblk);
+	return 0;
+}
+
+// Allocate blocks for the extent-mapped file 'f' up to and including
+// 'filebno'.  Allocated blocks always form a prefix of the file.
+// Each new block goes right after the previous one on disk when that
+// block is free, so a file written sequentially stays in one extent.
+static int
+extent_grow(struct File *f, uint32_t filebno)
+{
+	int r, bno;
+	uint32_t goal;
+	struct Extent *e;
+
+	if (filebno >= MAXEXTFILESIZE / BLKSIZE)
+		return -E_INVAL;
+
+	while (f->f_nblocks <= filebno) {
+		goal = file_home_block(f);
+		if (f->f_nextent > 0) {
+			if ((r = extent_slot(f, f->f_nextent - 1, &e, 0)) < 0)
+				return r;
+			goal = e->e_diskblk + (f->f_nblocks - e->e_fileblk);
+		}
+		if ((bno = alloc_block_near(goal)) < 0)
+			return bno;
+		if (f->f_nextent == 0 || bno != goal) {
+			if ((r = extent_slot(f, f->f_nextent, &e, 1)) < 0) {
+				free_block(bno);
+				return r;
+			}
+			e->e_fileblk = f->f_nblocks;
+			e->e_diskblk = bno;
+			f->f_nextent++;
+		}
+		f->f_nblocks++;
+	}
+	return 0;
+}
+
+// Free the blocks of the extent-mapped file 'f' from file block
+// 'nblocks' on, along with extents and tree blocks no longer needed.
+static void
+extent_truncate(struct File *f, uint32_t nblocks)
+{
+	int r;
+	uint32_t end, start, bno, i, *idx;
+	struct Extent *e;
+
+	end = f->f_nblocks;
+	while (f->f_nextent > 0 && end > nblocks) {
+		if ((r = extent_slot(f, f->f_nextent - 1, &e, 0)) < 0) {
+			cprintf("warning: extent_truncate: %e", r);
+			return;
+		}
+		start = MAX(e->e_fileblk, nblocks);
+		for (bno = start; bno < end; bno++)
+			free_block(e->e_diskblk + (bno - e->e_fileblk));
+		end = e->e_fileblk;
+		if (e->e_fileblk < nblocks)
+			break;
+		e->e_fileblk = 0;
+		e->e_diskblk = 0;
+		f->f_nextent--;
+	}
+	f->f_nblocks = MIN(f->f_nblocks, nblocks);
+
+	if (f->f_exttree == 0)
+		return;
+	if ((r = read_block(f->f_exttree, (char **) &idx)) < 0) {
+		cprintf("warning: extent_truncate: %e", r);
+		return;
+	}
+	i = 0;
+	if (f->f_nextent > NEXTENT)
+		i = ROUNDUP(f->f_nextent - NEXTENT, EXTPERBLK) / EXTPERBLK;
+	for (; i < NEXTIDX; i++)
+		if (idx[i]) {
+			free_block(idx[i]);
+			idx[i] = 0;
+		}
+	if (f->f_nextent <= NEXTENT) {
+		free_block(f->f_exttree);
+		f->f_exttree = 0;
+	}
+}
+
 // Find the disk block number slot for the 'filebno'th block in file 'f'.
 // Set '*ppdiskbno' to point to that slot.
 // The slot will be one of the f->f_direct[] entries,
@@ -310,6 +838,8 @@ file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool all
 	default:
 		return -E_INVAL;
 	}
+	if (filebno >= NDIRECT)
+		journal_meta(f->f_indirect);
 	/* Found the corresponding entry */
 	*ppdiskbno = &ptr[filebno];
 	return 0;
@@ -328,13 +858,26 @@ int
 file_map_block(struct File *f, uint32_t filebno, uint32_t *diskbno, bool alloc)
 {
 	int r;
-	uint32_t *ptr;
+	uint32_t *ptr, *prev, goal;
+
+	if (super->s_magic == FS_MAGIC_EXT) {
+		if (alloc && filebno >= f->f_nblocks
+		    && (r = extent_grow(f, filebno)) < 0)
+			return r;
+		return extent_lookup(f, filebno, diskbno);
+	}
+
 	if ((r = file_block_walk(f, filebno, &ptr, alloc)) < 0)
 		return r;
 	if (*ptr == 0) {
 		if (alloc == 0)
 			return -E_NOT_FOUND;
-		if ((r = alloc_block()) < 0)
+		// Place the block right after the file's previous one
+		goal = file_home_block(f);
+		if (filebno > 0 && file_block_walk(f, filebno - 1, &prev, 0) == 0
+		    && *prev != 0)
+			goal = *prev + 1;
+		if ((r = alloc_block_near(goal)) < 0)
 			return r;
 		*ptr = r;
 	}
@@ -361,19 +904,90 @@ file_clear_block(struct File *f, uint32_t filebno)
 
 // Set *blk to point at the filebno'th block in file 'f'.
 // Allocate the block if it doesn't yet exist.
-// Returns 0 on success, < 0 on error.
+// Returns 0 on success, < 0 on error; -E_NOT_FOUND if the file was
+// truncated past filebno while the block was being read.
 int
 file_get_block(struct File *f, uint32_t filebno, char **blk)
 {
 	int r;
-	uint32_t diskbno;
+	uint32_t diskbno, now;
 
 	if ((r = file_map_block(f, filebno, &diskbno, 1)) < 0)
 		return r;
+	if (f->f_type == FTYPE_DIR) {
+		journal_meta(diskbno);
+		return read_block(diskbno, blk);
+	}
 
-	if ((r = read_block(diskbno, blk)) < 0)
-		return r;
-	return 0;
+	// Data blocks are read without the fs lock; start over if the
+	// block was moved while it was dropped.  Never allocate here: if
+	// the file was truncated past filebno meanwhile, the block is gone.
+	while ((r = read_data_block(diskbno, blk)) >= 0) {
+		r = file_map_block(f, filebno, &now, 0);
+		if (r == -E_NOT_FOUND || (r == 0 && now == 0))
+			return -E_NOT_FOUND;
+		if (r < 0)
+			return r;
+		if (now == diskbno)
+			return 0;
+		diskbno = now;
+	}
+	return r;
+}
+
+// Pages that prefetched blocks are read into.
+#define PREFETCHVA	0x0fd00000
+#define NPREFETCH	(256 / BLKSECTS)
+static bool prefetching;
+
+// Bring up to n blocks of f from filebno on into the cache at once,
+// so a large read goes to the disks as a few big commands, in parallel
+// on each channel, instead of block by block.  Only the first stretch
+// of uncached blocks that are contiguous on disk is read; file_get_block
+// does the rest.  Gives up the fs lock while the disks are busy.
+void
+file_prefetch(struct File *f, uint32_t filebno, int n)
+{
+	int i, k, r;
+	uint32_t start, bno;
+
+	if (f->f_type == FTYPE_DIR || prefetching)
+		return;
+	if (n > NPREFETCH)
+		n = NPREFETCH;
+
+	for (; n > 0; filebno++, n--) {
+		if (file_map_block(f, filebno, &start, 0) < 0)
+			return;
+		if (!block_is_mapped(start))
+			break;
+	}
+	for (k = 1; k < n; k++)
+		if (file_map_block(f, filebno + k, &bno, 0) < 0
+		    || bno != start + k || block_is_mapped(bno))
+			break;
+	if (n < 2 || k < 2)
+		return;
+
+	prefetching = 1;
+	for (i = 0; i < k; i++)
+		if ((r = sys_page_alloc(0, (void *) (PREFETCHVA + i * PGSIZE), PTE_U|PTE_P|PTE_W)) < 0)
+			goto out;
+	fs_unlock();
+	r = disk_read_run(start, k, (char *) PREFETCHVA);
+	fs_lock();
+
+	// The file may have changed while the lock was dropped: cache only
+	// the blocks that are still its own and that nobody cached meanwhile.
+	for (i = 0; r >= 0 && i < k; i++)
+		if (file_map_block(f, filebno + i, &bno, 0) == 0
+		    && bno == start + i && !block_is_mapped(bno))
+			sys_page_map(0, (void *) (PREFETCHVA + i * PGSIZE),
+				     0, diskaddr(bno), PTE_U|PTE_P|PTE_W);
+out:
+	for (i = 0; i < k; i++)
+		sys_page_unmap(0, (void *) (PREFETCHVA + i * PGSIZE));
+	prefetching = 0;
 }
 
 // Mark the block at offset as dirty in file f
@@ -391,14 +1005,207 @@ file_dirty(struct File *f, off_t offset)
 	return 0;
 }
 
+// Directory index.
+//
+// The first lookup in a directory hashes all of its entries into an
+// open-addressed table in memory.  Later lookups, creations and
+// removals go through the table instead of strcmp'ing every File in
+// the directory, and dir_alloc_file starts looking for a free File at
+// the first block that may have one.  Directories whose table would
+// not fit in one malloc chunk are still searched linearly.
+
+#define NDIRIDX		32		// directories indexed at once
+#define DIRIDX_MINSLOT	256
+#define DIRIDX_MAXBLK	2000		// keeps a table below MAXMALLOC
+
+struct DirSlot {
+	uint32_t ds_hash;		// name_hash(ds_file->f_name)
+	uint32_t ds_blk;		// block of the directory holding ds_file
+	struct File *ds_file;		// 0 if the slot is empty
+};
+
+struct DirIndex {
+	struct File *di_dir;		// indexed directory, 0 if unused
+	struct DirSlot *di_slot;
+	uint32_t di_nslot;		// a power of 2
+	uint32_t di_count;		// slots in use
+	uint32_t di_freeblk;		// no free File before this block
+	uint32_t di_used;		// for LRU replacement
+};
+
+static struct DirIndex diridx[NDIRIDX];
+static uint32_t diridx_clock;
+
+// FNV-1a
+static uint32_t
+name_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (uint8_t) *name++) * 16777619;
+	return h;
+}
+
+static void
+diridx_put(struct DirIndex *di, struct File *f, uint32_t blk)
+{
+	uint32_t h, i, mask;
+
+	mask = di->di_nslot - 1;
+	h = name_hash(f->f_name);
+	for (i = h & mask; di->di_slot[i].ds_file; i = (i + 1) & mask)
+		;
+	di->di_slot[i].ds_hash = h;
+	di->di_slot[i].ds_blk = blk;
+	di->di_slot[i].ds_file = f;
+	di->di_count++;
+}
+
+static void
+diridx_drop(struct DirIndex *di)
+{
+	if (di->di_dir)
+		free(di->di_slot);
+	memset(di, 0, sizeof(*di));
+}
+
+// Build an index for 'dir', replacing the least recently used one.
+// Returns 0 if the directory cannot be indexed.
+static struct DirIndex *
+diridx_build(struct File *dir)
+{
+	struct DirIndex *di;
+	uint32_t i, j, n, nblock, nslot;
+	char *blk;
+	struct File *f;
+
+	nblock = dir->f_size / BLKSIZE;
+	if (nblock > DIRIDX_MAXBLK)
+		return 0;
+	n = 0;
+	for (i = 0; i < nblock; i++) {
+		if (file_get_block(dir, i, &blk) < 0)
+			return 0;
+		f = (struct File*) blk;
+		for (j = 0; j < BLKFILES; j++)
+			if (f[j].f_name[0] != '\0')
+				n++;
+	}
+	for (nslot = DIRIDX_MINSLOT; nslot < 2 * (n + 1); nslot *= 2)
+		;
+
+	di = &diridx[0];
+	for (i = 1; i < NDIRIDX && di->di_dir; i++)
+		if (!diridx[i].di_dir || diridx[i].di_used < di->di_used)
+			di = &diridx[i];
+	diridx_drop(di);
+	if ((di->di_slot = malloc(nslot * sizeof(struct DirSlot))) == 0)
+		return 0;
+	memset(di->di_slot, 0, nslot * sizeof(struct DirSlot));
+	di->di_dir = dir;
+	di->di_nslot = nslot;
+	di->di_freeblk = nblock;
+
+	for (i = 0; i < nblock; i++) {
+		file_get_block(dir, i, &blk);
+		f = (struct File*) blk;
+		for (j = 0; j < BLKFILES; j++)
+			if (f[j].f_name[0] != '\0')
+				diridx_put(di, &f[j], i);
+			else
+				di->di_freeblk = MIN(di->di_freeblk, i);
+	}
+	return di;
+}
+
+// Return the index of 'dir', building it if 'build' is set.
+static struct DirIndex *
+diridx_get(struct File *dir, bool build)
+{
+	struct DirIndex *di;
+	int i;
+
+	for (i = 0; i < NDIRIDX; i++)
+		if (diridx[i].di_dir == dir)
+			break;
+	if (i < NDIRIDX)
+		di = &diridx[i];
+	else if (!build || (di = diridx_build(dir)) == 0)
+		return 0;
+	di->di_used = ++diridx_clock;
+	return di;
+}
+
+// Forget the index of 'dir', if it has one.
+static void
+diridx_forget(struct File *dir)
+{
+	struct DirIndex *di;
+
+	if ((di = diridx_get(dir, 0)) != 0)
+		diridx_drop(di);
+}
+
+// Record that 'f', in block 'blk' of 'dir', has just been named.
+static void
+diridx_add(struct File *dir, struct File *f, uint32_t blk)
+{
+	struct DirIndex *di;
+
+	if ((di = diridx_get(dir, 0)) == 0)
+		return;
+	if (2 * (di->di_count + 1) > di->di_nslot) {
+		// Rebuilding picks up f as well
+		diridx_drop(di);
+		diridx_build(dir);
+		return;
+	}
+	diridx_put(di, f, blk);
+}
+
+// Record that 'f', in directory 'dir', is about to lose its name.
+static void
+diridx_remove(struct File *dir, struct File *f)
+{
+	struct DirIndex *di;
+	uint32_t i, j, k, mask;
+
+	if ((di = diridx_get(dir, 0)) == 0)
+		return;
+	mask = di->di_nslot - 1;
+	for (i = name_hash(f->f_name) & mask; di->di_slot[i].ds_file != f;
+	     i = (i + 1) & mask)
+		if (di->di_slot[i].ds_file == 0)
+			return;
+	di->di_freeblk = MIN(di->di_freeblk, di->di_slot[i].ds_blk);
+	di->di_count--;
+
+	// Shift later entries of the probe run back over the hole,
+	// unless their home slot lies cyclically in (i, j].
+	j = i;
+	for (;;) {
+		di->di_slot[i].ds_file = 0;
+		do {
+			j = (j + 1) & mask;
+			if (di->di_slot[j].ds_file == 0)
+				return;
+			k = di->di_slot[j].ds_hash & mask;
+		} while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+		di->di_slot[i] = di->di_slot[j];
+		i = j;
+	}
+}
+
 // Try to find a file named "name" in dir.  If so, set *file to it.
 int
 dir_lookup(struct File *dir, const char *name, struct File **file)
 {
 	int r;
-	uint32_t i, j, nblock;
+	uint32_t i, j, h, nblock;
 	char *blk;
 	struct File *f;
+	struct DirIndex *di;
 	// Search dir for name.
 	// We maintain the invariant that the size of a directory-file
 	// is always a multiple of the file system's block size.
@@ -406,6 +1213,19 @@ dir_lookup(struct File *dir, const char *name, struct File **file)
 		cprintf("Look at directory %s for %s\n", dir->f_name, name);
 
 	assert((dir->f_size % BLKSIZE) == 0);
+	if ((di = diridx_get(dir, 1)) != 0) {
+		h = name_hash(name);
+		for (i = h & (di->di_nslot - 1); (f = di->di_slot[i].ds_file);
+		     i = (i + 1) & (di->di_nslot - 1))
+			if (di->di_slot[i].ds_hash == h
+			    && strcmp(f->f_name, name) == 0) {
+				*file = f;
+				f->f_dir = dir;
+				return 0;
+			}
+		return -E_NOT_FOUND;
+	}
+
 	nblock = dir->f_size / BLKSIZE;
 	for (i = 0; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
@@ -424,37 +1244,141 @@ dir_lookup(struct File *dir, const char *name, struct File **file)
 	return -E_NOT_FOUND;
 }
 
-// Set *file to point at a free File structure in dir.
+// Set *file to point at a free File structure in dir,
+// and give it the name "name".
 int
-dir_alloc_file(struct File *dir, struct File **file)
+dir_alloc_file(struct File *dir, const char *name, struct File **file)
 {
 	int r;
 	uint32_t nblock, i, j;
 	char *blk;
 	struct File *f;
+	struct DirIndex *di;
 
 	assert((dir->f_size % BLKSIZE) == 0);
 	nblock = dir->f_size / BLKSIZE;
-	for (i = 0; i < nblock; i++) {
+	i = 0;
+	if ((di = diridx_get(dir, 0)) != 0)
+		i = di->di_freeblk;
+	for (; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
 			return r;
 		f = (struct File*) blk;
 		for (j = 0; j < BLKFILES; j++)
-			if (f[j].f_name[0] == '\0') {
-				*file = &f[j];
-				f[j].f_dir = dir;
-				return 0;
-			}
+			if (f[j].f_name[0] == '\0')
+				goto found;
 	}
 	dir->f_size += BLKSIZE;
 	if ((r = file_get_block(dir, i, &blk)) < 0)
 		return r;
 	f = (struct File*) blk;
-	*file = &f[0];
-	f[0].f_dir = dir;
+	j = 0;
+found:
+	if (di)
+		di->di_freeblk = i;
+	*file = &f[j];
+	f[j].f_dir = dir;
+	strcpy(f[j].f_name, name);
+	diridx_add(dir, &f[j], i);
 	return 0;
 }
 
+// Dentry cache.
+//
+// Remembers the outcome of recent (directory, name) lookups, including
+// failed ones, so walk_path does not go back to the directory for the
+// path components every request repeats.  Direct-mapped; a colliding
+// lookup just replaces the entry.
+
+#define NDCACHE		256
+
+struct Dentry {
+	struct File *d_dir;		// directory searched, 0 if unused
+	struct File *d_file;		// what was found, 0 if nothing
+	char d_name[MAXNAMELEN];
+};
+
+static struct Dentry dcache[NDCACHE];
+
+static struct Dentry *
+dcache_slot(struct File *dir, const char *name)
+{
+	uint32_t h;
+
+	h = name_hash(name) + (uintptr_t) dir / sizeof(struct File);
+	return &dcache[h % NDCACHE];
+}
+
+// If (dir, name) is cached, set *pf to the cached file (0 for a cached
+// miss) and return 1.  Otherwise return 0.
+static int
+dcache_lookup(struct File *dir, const char *name, struct File **pf)
+{
+	struct Dentry *d = dcache_slot(dir, name);
+
+	if (d->d_dir != dir || strcmp(d->d_name, name) != 0)
+		return 0;
+	*pf = d->d_file;
+	return 1;
+}
+
+static void
+dcache_enter(struct File *dir, const char *name, struct File *f)
+{
+	struct Dentry *d = dcache_slot(dir, name);
+
+	d->d_dir = dir;
+	d->d_file = f;
+	strcpy(d->d_name, name);
+}
+
+// Forget the entry for (dir, name).
+static void
+dcache_forget(struct File *dir, const char *name)
+{
+	struct Dentry *d = dcache_slot(dir, name);
+
+	if (d->d_dir == dir && strcmp(d->d_name, name) == 0)
+		d->d_dir = 0;
+}
+
+// Forget every entry for names in directory 'dir'.
+static void
+dcache_forget_dir(struct File *dir)
+{
+	int i;
+
+	for (i = 0; i < NDCACHE; i++)
+		if (dcache[i].d_dir == dir)
+			dcache[i].d_dir = 0;
+}
+
+// Forget the index and cached lookups of directory 'dir' and of the
+// directories in it.  Called before dir's blocks are freed: the Files of
+// its subdirectories live in those blocks, and another directory may
+// later come to live at the same address.
+static void
+dir_forget(struct File *dir)
+{
+	struct File *f;
+	char *blk;
+	uint32_t i, j, nblock;
+
+	diridx_forget(dir);
+	dcache_forget_dir(dir);
+	nblock = dir->f_size / BLKSIZE;
+	for (i = 0; i < nblock; i++) {
+		if (file_get_block(dir, i, &blk) < 0)
+			continue;
+		f = (struct File*) blk;
+		for (j = 0; j < BLKFILES; j++)
+			if (f[j].f_name[0] && f[j].f_type == FTYPE_DIR) {
+				diridx_forget(&f[j]);
+				dcache_forget_dir(&f[j]);
+			}
+	}
+}
+
 // Skip over slashes.
 static inline const char*
 skip_slash(const char *p)
@@ -500,7 +1424,16 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
 		if (dir->f_type != FTYPE_DIR)
 			return -E_NOT_FOUND;
 
-		if ((r = dir_lookup(dir, name, &f)) < 0) {
+		if (dcache_lookup(dir, name, &f)) {
+			if (f)
+				f->f_dir = dir;
+			r = f ? 0 : -E_NOT_FOUND;
+		} else {
+			r = dir_lookup(dir, name, &f);
+			if (r == 0 || r == -E_NOT_FOUND)
+				dcache_enter(dir, name, r == 0 ? f : 0);
+		}
+		if (r < 0) {
 			if (r == -E_NOT_FOUND && *path == '\0') {
 				if (pdir)
 					*pdir = dir;
@@ -531,9 +1464,9 @@ file_create(const char *path, struct File **pf)
 		return -E_FILE_EXISTS;
 	if (r != -E_NOT_FOUND || dir == 0)
 		return r;
-	if (dir_alloc_file(dir, &f) < 0)
+	if ((r = dir_alloc_file(dir, name, &f)) < 0)
 		return r;
-	strcpy(f->f_name, name);
+	dcache_forget(dir, name);
 	*pf = f;
 	return 0;
 }
@@ -554,8 +1487,15 @@ file_truncate_blocks(struct File *f, off_t newsize)
 	int r;
 	uint32_t bno, old_nblocks, new_nblocks;
 
-	old_nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
 	new_nblocks = (newsize + BLKSIZE - 1) / BLKSIZE;
+	if (super->s_magic == FS_MAGIC_EXT) {
+		extent_truncate(f, new_nblocks);
+		return;
+	}
+
+	// Blocks may have been preallocated past the end of the file
+	old_nblocks = f->f_indirect ? NINDIRECT : NDIRECT;
+
 	for (bno = new_nblocks; bno < old_nblocks; bno++)
 		if ((r = file_clear_block(f, bno)) < 0)
 			cprintf("warning: file_clear_block: %e", r);
@@ -566,30 +1506,88 @@ file_truncate_blocks(struct File *f, off_t newsize)
 	}
 }
 
+// Write out the metadata changed on behalf of file f: the bitmap and
+// f's directory.  With a journal, commit all dirty metadata instead.
+static void
+file_flush_meta(struct File *f)
+{
+	if (super->s_njournal) {
+		journal_commit();
+		return;
+	}
+	flush_bitmap();
+	if (f->f_dir)
+		file_flush(f->f_dir);
+}
+
 int
 file_set_size(struct File *f, off_t newsize)
 {
-	if (f->f_size > newsize)
+	if (newsize < 0 || newsize > fs_maxfilesize())
+		return -E_INVAL;
+	if (f->f_size > newsize) {
+		if (f->f_type == FTYPE_DIR)
+			dir_forget(f);
 		file_truncate_blocks(f, newsize);
+	}
 	f->f_size = newsize;
-	if (f->f_dir)
-		file_flush(f->f_dir);
+	file_flush_meta(f);
 	return 0;
 }
 
+// Allocate the blocks of f up to size bytes ahead of time, placing them
+// after the file's last block where the disk allows.  The size of f is
+// not changed.  Returns the number of bytes f now has blocks for.
+int
+file_prealloc(struct File *f, off_t size)
+{
+	int r;
+	uint32_t bno, nblocks, diskbno;
+
+	if (size < 0 || size > fs_maxfilesize())
+		return -E_INVAL;
+	nblocks = ROUNDUP(size, BLKSIZE) / BLKSIZE;
+	if (super->s_magic == FS_MAGIC_EXT) {
+		if (nblocks > f->f_nblocks
+		    && (r = extent_grow(f, nblocks - 1)) < 0)
+			return r;
+		nblocks = f->f_nblocks;
+	} else {
+		for (bno = 0; bno < nblocks; bno++)
+			if ((r = file_map_block(f, bno, &diskbno, 1)) < 0)
+				return r;
+	}
+	file_flush_meta(f);
+	return nblocks * BLKSIZE;
+}
+
+// Free the blocks of f past its end, such as preallocated ones that
+// were never written.
+void
+file_trim(struct File *f)
+{
+	file_truncate_blocks(f, f->f_size);
+}
+
 // Flush the contents of file f out to disk.
 // Loop over all the blocks in file.
 // Translate the file block number into a disk block number
 // and then check whether that disk block is dirty.  If so, write it out.
+// With a journal, metadata blocks are left to journal_commit.
 void
 file_flush(struct File *f)
 {
-	int i;
+	int i, nblocks;
 	uint32_t diskbno;
 	
-	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
+	nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
+	if (super->s_magic == FS_MAGIC_EXT)
+		nblocks = MIN(nblocks, f->f_nblocks);
+	for (i = 0; i < nblocks; i++) {
 		if ( file_map_block(f, i, &diskbno, 0) < 0)
 			continue;
+		if (super->s_njournal && journal_is_meta(diskbno))
+			continue;
 		if (block_is_dirty(diskbno)){
 			if (debug)
 				cprintf("File %s flushes, blockno %x\n", f->f_name, diskbno);
@@ -604,8 +1602,11 @@ fs_sync(void)
 {
 	int i;
 	for (i = 0; i < super->s_nblocks; i++)
-		if (block_is_dirty(i))
+		if (block_is_dirty(i)
+		    && !(super->s_njournal && journal_is_meta(i)))
 			write_block(i);
+	if (super->s_njournal)
+		journal_commit();
 }
 
 // Close a file.
@@ -613,8 +1614,37 @@ void
 file_close(struct File *f)
 {
 	file_flush(f);
-	if (f->f_dir)
-		file_flush(f->f_dir);
+	file_flush_meta(f);
+}
+
+// Copy up to n used entries of directory dir, starting at entry *pos,
+// into d, and advance *pos past the last entry looked at.
+// Returns the number of entries copied, 0 at the end of the directory.
+int
+dir_read(struct File *dir, uint32_t *pos, struct Dirent *d, int n)
+{
+	int r, i;
+	uint32_t nent;
+	char *blk;
+	struct File *f;
+
+	if (dir->f_type != FTYPE_DIR)
+		return -E_INVAL;
+	nent = dir->f_size / sizeof(struct File);
+	blk = 0;
+	for (i = 0; *pos < nent && i < n; (*pos)++) {
+		if (!blk || *pos % BLKFILES == 0)
+			if ((r = file_get_block(dir, *pos / BLKFILES, &blk)) < 0)
+				return r;
+		f = (struct File*) blk + *pos % BLKFILES;
+		if (!f->f_name[0])
+			continue;
+		strcpy(d[i].d_name, f->f_name);
+		d[i].d_size = f->f_size;
+		d[i].d_type = f->f_type;
+		i++;
+	}
+	return i;
 }
 
 // Remove a file by truncating it and then zeroing the name.
@@ -627,11 +1657,16 @@ file_remove(const char *path)
 	if ((r = walk_path(path, 0, &f, 0)) < 0)
 		return r;
 
+	if (f->f_type == FTYPE_DIR)
+		dir_forget(f);
+	if (f->f_dir) {
+		diridx_remove(f->f_dir, f);
+		dcache_forget(f->f_dir, f->f_name);
+	}
 	file_truncate_blocks(f, 0);
 	f->f_name[0] = '\0';
 	f->f_size = 0;
-	if (f->f_dir)
-		file_flush(f->f_dir);
+	file_flush_meta(f);
 
 	return 0;
 }
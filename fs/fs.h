@@ -1,5 +1,6 @@
 #include <inc/fs.h>
 #include <inc/lib.h>
+#include <arch/thread.h>
 
 #define SECTSIZE	512			// bytes per disk sector
 #define BLKSECTS	(BLKSIZE / SECTSIZE)	// sectors per block
@@ -11,27 +12,57 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE	0xC0000000
 
+#define IDE_NDISK	4			// two channels, two drives each
+#define IDE_NCHANNEL	2
+
 /* ide.c */
-bool	ide_probe_disk1(void);
-void	ide_set_disk(int diskno);
-int	ide_read(uint32_t secno, void *dst, size_t nsecs);
-int	ide_write(uint32_t secno, const void *src, size_t nsecs);
+bool	ide_probe(int d);
+int	ide_channel(int d);
+uint32_t ide_pending(int d);
+void	ide_start(int d, uint32_t secno, size_t nsecs, bool write);
+int	ide_finish(int d, void *buf, size_t nsecs, bool write);
+int	ide_read(int d, uint32_t secno, void *dst, size_t nsecs);
+int	ide_write(int d, uint32_t secno, const void *src, size_t nsecs);
 
 /* fs.c */
+void	fs_lock(void);
+void	fs_unlock(void);
+char*	diskaddr(uint32_t blockno);
+int	disk_read(uint32_t blockno, void *va);
+int	disk_write(uint32_t blockno, const void *va);
+bool	block_is_mapped(uint32_t blockno);
+bool	block_is_dirty(uint32_t blockno);
+void	free_block(uint32_t blockno);
 int	file_create(const char *path, struct File **f);
 int	file_open(const char *path, struct File **f);
 int	file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
+int	file_map_block(struct File *f, uint32_t file_blockno, uint32_t *diskbno, bool alloc);
+void	file_prefetch(struct File *f, uint32_t file_blockno, int n);
 int	file_set_size(struct File *f, off_t newsize);
 void	file_flush(struct File *f);
 void	file_close(struct File *f);
 int	file_remove(const char *path);
+int	file_prealloc(struct File *f, off_t size);
+void	file_trim(struct File *f);
+int	dir_read(struct File *dir, uint32_t *pos, struct Dirent *d, int n);
 void	fs_init(void);
 int	file_dirty(struct File *f, off_t offset);
 void	fs_sync(void);
+off_t	fs_maxfilesize(void);
 
+extern struct Super *super;
 extern uint32_t *bitmap;
 int	map_block(uint32_t);
 int	alloc_block(void);
+int	alloc_block_near(uint32_t goal);
+void	flush_bitmap(void);
+
+/* journal.c */
+void	journal_init(void);
+void	journal_commit(void);
+void	journal_meta(uint32_t blockno);
+bool	journal_is_meta(uint32_t blockno);
+bool	journal_free(uint32_t blockno);
 
 /* test.c */
 void	fs_test(void);
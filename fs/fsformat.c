@@ -1,5 +1,13 @@
 /*
  * JOS file system format
+ *
+ * The image is built in two passes.  The first reads the host files
+ * and directories into a tree and lays the file system out: the boot
+ * block, superblock, bitmap and journal, then every directory block and
+ * indirect block, then the data of each file in one contiguous run.
+ * The second assembles all the metadata in memory, writes it out, and
+ * streams file data straight from the host files to the image in large
+ * writes, optionally with several threads copying files side by side.
  */
 
 #define _BSD_EXTENSION
@@ -19,6 +27,7 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <limits.h>
+#include <pthread.h>
 #undef off_t
 #undef bool
 
@@ -33,33 +42,61 @@ typedef int bool;
 #include <inc/mmu.h>
 #include <inc/fs.h>
 
-#define nelem(x)	(sizeof(x) / sizeof((x)[0]))
 typedef struct Super Super;
 typedef struct File File;
 
+// Largest disk the file system server handles (DISKSIZE in fs/fs.h)
+#define MAXNBLOCKS	(0xC0000000 / BLKSIZE)
+
+// Bytes of file data each copying thread moves per write
+#define COPYSIZE	(256 * BLKSIZE)
+
+#define MAXTHREADS	16
+
+// A file or directory to go in the image.
+struct Entry {
+	char name[MAXNAMELEN];
+	char *path;		// where it is on the host
+	uint32_t type;		// FTYPE_REG or FTYPE_DIR
+	uint32_t size;		// bytes
+	uint32_t nblk;		// blocks
+	uint32_t bno;		// first block; the rest follow it
+	uint32_t indirect;	// indirect block (non-extent file systems)
+	struct Entry *child;	// directory contents
+	struct Entry *lastchild;
+	struct Entry *next;	// next entry in the same directory
+	uint32_t nchild;
+};
+
 struct Super super;
-int diskfd;
+struct Entry root = { "/", "/", FTYPE_DIR };
+int extfs;		// map files by extents (FS_MAGIC_EXT)
+uint32_t njournal;	// blocks in the metadata journal
+uint32_t diskmode;	// FS_DISK_SINGLE, _STRIPE or _MIRROR
+uint32_t ndisks = 1;	// member disks
+uint32_t stripeunit = 4;	// blocks per stripe unit
+int nthreads = 1;	// threads copying file data
+int diskfd[FS_MAXDISKS];
 uint32_t nblocks;
 uint32_t nbitblock;
 uint32_t nextb;
 
-enum {
-	BLOCK_SUPER,
-	BLOCK_DIR,
-	BLOCK_FILE,
-	BLOCK_BITS
-};
+// Directory, indirect and other metadata blocks: [0, metaend)
+uint8_t *meta;
+uint32_t metaend;
 
-struct Block
-{
-	uint32_t busy;
-	uint32_t bno;
-	uint32_t used;
-	uint8_t buf[BLKSIZE];
-	uint32_t type;
-};
+// Regular files, in layout order
+struct Entry **files;
+int nfiles, maxfiles;
+int nextfile;		// next file for a copying thread to take
+pthread_mutex_t filelock = PTHREAD_MUTEX_INITIALIZER;
 
-struct Block cache[16];
+void
+fail(const char *what, const char *name)
+{
+	fprintf(stderr, "%s %s: %s\n", what, name, strerror(errno));
+	exit(1);
+}
 
 ssize_t
 readn(int f, void *av, size_t n)
@@ -70,7 +107,7 @@ readn(int f, void *av, size_t n)
 	a = av;
 	t = 0;
 	while (t < n) {
-		size_t m = read(f, a + t, n - t);
+		ssize_t m = read(f, a + t, n - t);
 		if (m <= 0) {
 			if (t == 0)
 				return m;
@@ -111,280 +148,158 @@ swizzlefile(struct File *f)
 }
 
 void
-swizzleblock(struct Block *b)
+swizzlewords(void *buf, int n)
 {
 	int i;
-	struct Super *s;
-	struct File *f;
-	uint32_t *u;
-
-	switch (b->type) {
-	case BLOCK_SUPER:
-		s = (struct Super*) b->buf;
-		swizzle(&s->s_magic);
-		swizzle(&s->s_nblocks);
-		swizzlefile(&s->s_root);
-		break;
-	case BLOCK_DIR:
-		f = (struct File*) b->buf;
-		for (i = 0; i < BLKFILES; i++)
-			swizzlefile(f + i);
-		break;
-	case BLOCK_BITS:
-		u = (uint32_t*) b->buf;
-		for (i = 0; i < BLKSIZE / 4; i++)
-			swizzle(u + i);
-		break;
-	}
-}
 
-void
-flushb(struct Block *b)
-{
-	swizzleblock(b);
-	if (lseek(diskfd, b->bno * BLKSIZE, 0) < 0
-	    || write(diskfd, b->buf, BLKSIZE) != BLKSIZE) {
-		perror("flushb");
-		fprintf(stderr, "\n");
-		abort();
-	}
-	swizzleblock(b);
+	for (i = 0; i < n; i++)
+		swizzle((uint32_t*) buf + i);
 }
 
-struct Block*
-getblk(uint32_t bno, int clr, uint32_t type)
+// Write nblk blocks from buf to the image at block bno, spreading them
+// over the member disks of a striped or mirrored file system.
+void
+diskwrite(const void *buf, uint32_t bno, uint32_t nblk)
 {
-	int i, least;
-	static int t = 1;
-	struct Block *b;
-
-	if (bno >= nblocks) {
-		fprintf(stderr, "attempt to access past end of disk bno=%d\n", bno);
-		abort();
-	}
-
-	least = -1;
-	for (i = 0; i < nelem(cache); i++) {
-		if (cache[i].bno == bno) {
-			b = &cache[i];
-			goto out;
+	const uint8_t *p = buf;
+	uint32_t n, unit;
+	uint64_t off;
+	size_t len, t;
+	ssize_t m;
+	int i, d, nd;
+
+	while (nblk > 0) {
+		if (diskmode == FS_DISK_STRIPE) {
+			unit = bno / stripeunit;
+			n = stripeunit - bno % stripeunit;
+			if (n > nblk)
+				n = nblk;
+			d = unit % ndisks;
+			nd = 1;
+			off = ((uint64_t) (unit / ndisks) * stripeunit
+			       + bno % stripeunit) * BLKSIZE;
+		} else {
+			// Mirrored, every member gets every block
+			n = nblk;
+			d = 0;
+			nd = ndisks;
+			off = (uint64_t) bno * BLKSIZE;
 		}
-		if (!cache[i].busy
-		    && (least == -1 || cache[i].used < cache[least].used))
-			least = i;
-	}
-
-	if (least == -1) {
-		fprintf(stderr, "panic: block cache full\n");
-		abort();
-	}
 
-	b = &cache[least];
-	if (b->used)
-		flushb(b);
-
-	if (lseek(diskfd, bno*BLKSIZE, 0) < 0
-	    || readn(diskfd, b->buf, BLKSIZE) != BLKSIZE) {
-		fprintf(stderr, "read block %d: ", bno);
-		perror("");
-		fprintf(stderr, "\n");
-		abort();
-	}
-	b->bno = bno;
-	if (!clr)
-		swizzleblock(b);
-
-out:
-	if (clr)
-		memset(b->buf, 0, sizeof(b->buf));
-	b->used = ++t;
-	if (b->busy) {
-		fprintf(stderr, "panic: block #%d is busy\n", b->bno);
-		abort();
+		len = (size_t) n * BLKSIZE;
+		for (i = d; i < d + nd; i++)
+			for (t = 0; t < len; t += m)
+				if ((m = pwrite(diskfd[i], p + t, len - t, off + t)) <= 0)
+					fail("write", "image");
+		p += len;
+		bno += n;
+		nblk -= n;
 	}
-	/* it is important to reset b->type in case we reuse a block for a
-	 * different purpose while it is still in the cache - this can happen
-	 * for example if a file ends exactly on a block boundary */
-	b->type = type;
-	b->busy = 1;
-	return b;
-}
-
-void
-putblk(struct Block *b)
-{
-	b->busy = 0;
 }
 
+// Create the image file of each member disk, at its full size.
 void
-opendisk(const char *name)
+opendisks(const char *name)
 {
-	int i, r;
-	struct Block *b;
-
-	if ((diskfd = open(name, O_RDWR | O_CREAT, 0666)) < 0) {
-		fprintf(stderr, "open %s: ", name);
-		perror("");
-		fprintf(stderr, "\n");
-		abort();
-	}
+	char path[PATH_MAX];
+	uint64_t size;
+	uint32_t units;
+	int i;
 
-	if ((r = ftruncate(diskfd, 0)) < 0
-	    || (r = ftruncate(diskfd, nblocks * BLKSIZE)) < 0) {
-		fprintf(stderr, "truncate %s: ", name);
-		perror("");
-		abort();
+	size = (uint64_t) nblocks * BLKSIZE;
+	if (diskmode == FS_DISK_STRIPE) {
+		units = (nblocks + stripeunit - 1) / stripeunit;
+		size = (uint64_t) (units + ndisks - 1) / ndisks * stripeunit * BLKSIZE;
 	}
 
-	nbitblock = (nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
-	for (i = 0; i < nbitblock; i++){
-		b = getblk(2 + i, 0, BLOCK_BITS);
-		memset(b->buf, 0xFF, BLKSIZE);
-		putblk(b);
+	for (i = 0; i < ndisks; i++) {
+		if (i == 0)
+			snprintf(path, sizeof(path), "%s", name);
+		else
+			snprintf(path, sizeof(path), "%s.%d", name, i);
+		if ((diskfd[i] = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
+			fail("open", path);
+		if (ftruncate(diskfd[i], size) < 0)
+			fail("truncate", path);
 	}
-
-	nextb = 2 + nbitblock;
-
-	super.s_magic = FS_MAGIC;
-	super.s_nblocks = nblocks;
-	super.s_root.f_type = FTYPE_DIR;
-	strcpy(super.s_root.f_name, "/");
 }
 
-void
-storeblk(struct File *f, struct Block *b, int nblk)
+// Add an entry for host file 'path' to directory 'dir'.
+struct Entry *
+addentry(struct Entry *dir, const char *path, uint32_t type)
 {
-	if (nblk < NDIRECT)
-		f->f_direct[nblk] = b->bno;
-	else if (nblk < NINDIRECT) {
-		struct Block *bindir;
-		if (f->f_indirect == 0) {
-			bindir = getblk(nextb++, 1, BLOCK_BITS);
-			f->f_indirect = bindir->bno;
-		} else
-			bindir = getblk(f->f_indirect, 0, BLOCK_BITS);
-		((uint32_t*)bindir->buf)[nblk] = b->bno;
-		putblk(bindir);
-	} else {
-		fprintf(stderr, "file too large\n");
-		abort();
-	}
-}
+	struct Entry *e;
+	const char *last;
 
-struct File *
-allocfile(struct File *dirf, const char *name, struct Block **dirb)
-{
-	struct File *ino;
-	int nblk, i;
-
-	nblk = (int)((dirf->f_size + BLKSIZE - 1) / BLKSIZE) - 1;
-	if (nblk >= NDIRECT) {
-		struct Block *idirb = getblk(dirf->f_indirect, 0, BLOCK_BITS);
-		*dirb = getblk(((uint32_t*)idirb->buf) [nblk], 0, BLOCK_DIR);
-		putblk(idirb);
-	} else if (nblk >= 0)
-		*dirb = getblk(dirf->f_direct[nblk], 0, BLOCK_DIR);
+	last = strrchr(path, '/');
+	if (last)
+		last++;
 	else
-		goto new_dirb;
+		last = path;
+	if (strlen(last) >= MAXNAMELEN) {
+		fprintf(stderr, "%s: name too long\n", path);
+		exit(1);
+	}
 
-	ino = (struct File *) (*dirb)->buf;
-	for (i = 0; i < BLKFILES; i++)
-		if (ino[i].f_name[0] == '\0') {
-			ino = &ino[i];
-			goto gotit;
-		}
+	if ((e = calloc(1, sizeof(*e))) == 0 || (e->path = strdup(path)) == 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	strcpy(e->name, last);
+	e->type = type;
 
-	putblk(*dirb);
-
-new_dirb:
-	*dirb = getblk(nextb++, 1, BLOCK_DIR);
-	storeblk(dirf, *dirb, ++nblk);
-	dirf->f_size += BLKSIZE;
-	assert((nblk + 1) * BLKSIZE == dirf->f_size);
-	
-	ino = (struct File *) (*dirb)->buf;
-	
-gotit:
-	strcpy(ino->f_name, name);
-	return ino;
+	if (dir->lastchild)
+		dir->lastchild->next = e;
+	else
+		dir->child = e;
+	dir->lastchild = e;
+	dir->nchild++;
+	return e;
 }
 
 void
-writefile(struct File *dirf, const char *name)
+addfile(struct Entry *dir, const char *path)
 {
-	int fd;
-	const char *last;
-	File *f;
-	int n, nblk;
-	struct Block *dirb, *b;
-
-	if ((fd = open(name, O_RDONLY)) < 0) {
-		fprintf(stderr, "open %s:", name);
-		perror("");
-		abort();
+	struct Entry *e;
+	struct stat s;
+	uint64_t max;
+
+	if (stat(path, &s) < 0)
+		fail("stat", path);
+	max = extfs ? MAXEXTFILESIZE : MAXFILESIZE;
+	if ((uint64_t) s.st_size > max) {
+		fprintf(stderr, "%s: file too large\n", path);
+		exit(1);
 	}
 
-	last = strrchr(name, '/');
-	if (last)
-		last++;
-	else
-		last = name;
-
-	f = allocfile(dirf, last, &dirb);
-	f->f_type = FTYPE_REG;
-
-	n = 0;
-	for (nblk = 0; ; nblk++) {
-		b = getblk(nextb, 1, BLOCK_FILE);
-		n = readn(fd, b->buf, BLKSIZE);
-		if (n < 0) {
-			fprintf(stderr, "reading %s: ", name);
-			perror("");
-			abort();
-		}
-		if (n == 0) {
-			putblk(b);
-			break;
+	e = addentry(dir, path, FTYPE_REG);
+	e->size = s.st_size;
+	e->nblk = (e->size + BLKSIZE - 1) / BLKSIZE;
+
+	if (nfiles == maxfiles) {
+		maxfiles = maxfiles ? 2 * maxfiles : 64;
+		if ((files = realloc(files, maxfiles * sizeof(files[0]))) == 0) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
 		}
-		nextb++;
-		storeblk(f, b, nblk);
-		putblk(b);
-		if (n < BLKSIZE)
-			break;
 	}
-	f->f_size = nblk*BLKSIZE + n;
-	putblk(dirb);
+	files[nfiles++] = e;
 }
 
 void
-writedirectory(struct File *parentdirf, char *name, int root)
+adddirectory(struct Entry *parent, char *name, int root)
 {
-	struct File *dirf;
-	DIR *dir;
+	struct Entry *dir;
+	DIR *d;
 	struct dirent *ent;
 	struct stat s;
 	char pathbuf[PATH_MAX];
 	int namelen;
-	struct Block *dirb = NULL;
 
-	if ((dir = opendir(name)) == NULL) {
-		fprintf(stderr, "open %s:", name);
-		perror("");
-		abort();
-	}
-
-	if (!root) {
-		const char *last = strrchr(name, '/');
-		if (last)
-			last++;
-		else
-			last = name;
+	if ((d = opendir(name)) == NULL)
+		fail("open", name);
 
-		dirf = allocfile(parentdirf, last, &dirb);
-		dirf->f_type = FTYPE_DIR;
-		dirf->f_size = 0;
-	} else
-		dirf = parentdirf;
+	dir = root ? parent : addentry(parent, name, FTYPE_DIR);
 
 	strcpy(pathbuf, name);
 	namelen = strlen(pathbuf);
@@ -393,69 +308,270 @@ writedirectory(struct File *parentdirf, char *name, int root)
 		pathbuf[namelen] = 0;
 	}
 
-	while ((ent = readdir(dir)) != NULL) {
+	while ((ent = readdir(d)) != NULL) {
 		int ent_namlen = strlen(ent->d_name);
 		strcpy(pathbuf + namelen, ent->d_name);
 
 		// don't depend on unreliable parts of the dirent structure
 		if (stat(pathbuf, &s) < 0)
 			continue;
-		
+
 		if (S_ISREG(s.st_mode))
-			writefile(dirf, pathbuf);
+			addfile(dir, pathbuf);
 		else if (S_ISDIR(s.st_mode)
 			 && (ent_namlen > 1 || ent->d_name[0] != '.')
 			 && (ent_namlen > 2 || ent->d_name[0] != '.' || ent->d_name[1] != '.')
 			 && (ent_namlen > 3 || ent->d_name[0] != 'C' || ent->d_name[1] != 'V' || ent->d_name[2] != 'S'))
-			writedirectory(dirf, pathbuf, 0);
+			adddirectory(dir, pathbuf, 0);
 	}
 
-	closedir(dir);
-	if (dirb)
-		putblk(dirb);
+	closedir(d);
+}
+
+// Take the next n blocks of the disk.
+uint32_t
+allocblocks(uint32_t n)
+{
+	uint32_t bno = nextb;
+
+	if (n > nblocks - nextb) {
+		fprintf(stderr, "disk full: %d blocks are not enough\n", nblocks);
+		exit(1);
+	}
+	nextb += n;
+	return bno;
+}
+
+// Place the blocks of directory d, and of the indirect blocks of
+// everything in it.
+void
+layoutdir(struct Entry *d)
+{
+	struct Entry *e;
+
+	d->nblk = (d->nchild + BLKFILES - 1) / BLKFILES;
+	d->size = d->nblk * BLKSIZE;
+	if (!extfs && d->nblk > NINDIRECT) {
+		fprintf(stderr, "%s: directory too large\n", d->path);
+		exit(1);
+	}
+	d->bno = d->nblk ? allocblocks(d->nblk) : 0;
+	if (!extfs && d->nblk > NDIRECT)
+		d->indirect = allocblocks(1);
+
+	for (e = d->child; e; e = e->next)
+		if (e->type == FTYPE_DIR)
+			layoutdir(e);
+		else if (!extfs && e->nblk > NDIRECT)
+			e->indirect = allocblocks(1);
 }
 
 void
-finishfs(void)
+layout(void)
 {
 	int i;
-	struct Block *b;
 
-	for (i = 0; i < nextb; i++) {
-		b = getblk(2 + i/BLKBITSIZE, 0, BLOCK_BITS);
-		((uint32_t*)b->buf)[(i%BLKBITSIZE)/32] &= ~(1<<(i%32));
-		putblk(b);
+	nbitblock = (nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
+	nextb = 2;
+	allocblocks(nbitblock);
+
+	if (njournal) {
+		super.s_journal = allocblocks(njournal);
+		super.s_njournal = njournal;
+	}
+
+	layoutdir(&root);
+	metaend = nextb;
+
+	for (i = 0; i < nfiles; i++)
+		files[i]->bno = files[i]->nblk ? allocblocks(files[i]->nblk) : 0;
+}
+
+uint8_t *
+metablk(uint32_t bno)
+{
+	assert(bno < metaend);
+	return meta + (size_t) bno * BLKSIZE;
+}
+
+// Fill in the File for e, and its indirect block.
+void
+fillfile(struct File *f, struct Entry *e)
+{
+	uint32_t i, *ind;
+
+	strcpy(f->f_name, e->name);
+	f->f_size = e->size;
+	f->f_type = e->type;
+
+	if (extfs) {
+		// Each file is one contiguous run: a single extent
+		if (e->nblk) {
+			f->f_extent[0].e_fileblk = 0;
+			f->f_extent[0].e_diskblk = e->bno;
+			f->f_nextent = 1;
+		}
+		f->f_nblocks = e->nblk;
+	} else {
+		for (i = 0; i < e->nblk && i < NDIRECT; i++)
+			f->f_direct[i] = e->bno + i;
+		if (e->indirect) {
+			f->f_indirect = e->indirect;
+			ind = (uint32_t*) metablk(e->indirect);
+			for (i = NDIRECT; i < e->nblk; i++)
+				ind[i] = e->bno + i;
+			swizzlewords(ind, NINDIRECT);
+		}
+	}
+	swizzlefile(f);
+}
+
+void
+filldir(struct Entry *d)
+{
+	struct File *f;
+	struct Entry *e;
+
+	f = d->nblk ? (struct File*) metablk(d->bno) : 0;
+	for (e = d->child; e; e = e->next, f++) {
+		fillfile(f, e);
+		if (e->type == FTYPE_DIR)
+			filldir(e);
+	}
+}
+
+// Assemble all of the metadata and write it out.
+void
+writemeta(void)
+{
+	struct JournalHeader *jh;
+	uint32_t *bits, i;
+
+	if ((meta = calloc(metaend, BLKSIZE)) == 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	// Blocks past the end of the layout are free
+	bits = (uint32_t*) metablk(2);
+	for (i = nextb; i < nblocks; i++)
+		bits[i / 32] |= 1 << (i % 32);
+	swizzlewords(bits, nbitblock * BLKSIZE / 4);
+
+	if (njournal) {
+		// The rest of the journal need not be cleared: transactions
+		// are only replayed if their sequence numbers follow on.
+		jh = (struct JournalHeader*) metablk(super.s_journal);
+		jh->jh_magic = JHDR_MAGIC;
+		jh->jh_seq = 1;
+		swizzlewords(jh, sizeof(*jh) / 4);
+	}
+
+	filldir(&root);
+
+	super.s_magic = extfs ? FS_MAGIC_EXT : FS_MAGIC;
+	super.s_nblocks = nblocks;
+	if (ndisks > 1) {
+		super.s_diskmode = diskmode;
+		super.s_ndisks = ndisks;
+		super.s_stripe = stripeunit;
 	}
+	fillfile(&super.s_root, &root);
+	swizzle(&super.s_magic);
+	swizzle(&super.s_nblocks);
+	swizzle(&super.s_journal);
+	swizzle(&super.s_njournal);
+	swizzle(&super.s_diskmode);
+	swizzle(&super.s_ndisks);
+	swizzle(&super.s_stripe);
+	memmove(metablk(1), &super, sizeof(Super));
+
+	if (njournal) {
+		diskwrite(meta, 0, super.s_journal + 1);
+		i = super.s_journal + njournal;
+		diskwrite(metablk(i), i, metaend - i);
+	} else
+		diskwrite(meta, 0, metaend);
+}
 
-	// this is slow but not too slow.  i do not care
-	if (nblocks != nbitblock*BLKBITSIZE) {
-		b = getblk(2+nbitblock-1, 0, BLOCK_BITS);
-		for (i = nblocks % BLKBITSIZE; i < BLKBITSIZE; i++)
-			((uint32_t*)b->buf)[i/32] &= ~(1<<(i%32));
-		putblk(b);
+// Copy the data of file e into its blocks.
+void
+copyfile(struct Entry *e, uint8_t *buf)
+{
+	int fd;
+	uint32_t off, n;
+	ssize_t m;
+
+	if ((fd = open(e->path, O_RDONLY)) < 0)
+		fail("open", e->path);
+
+	for (off = 0; off < e->size; off += n) {
+		n = e->size - off;
+		if (n > COPYSIZE)
+			n = COPYSIZE;
+		if ((m = readn(fd, buf, n)) != n) {
+			if (m >= 0)
+				errno = EIO;	// the file shrank
+			fail("read", e->path);
+		}
+		memset(buf + n, 0, (BLKSIZE - n % BLKSIZE) % BLKSIZE);
+		diskwrite(buf, e->bno + off / BLKSIZE, (n + BLKSIZE - 1) / BLKSIZE);
 	}
+	close(fd);
+}
+
+void *
+copythread(void *arg)
+{
+	uint8_t *buf;
+	int i;
 
-	b = getblk(1, 1, BLOCK_SUPER);
-	memmove(b->buf, &super, sizeof(Super));
-	putblk(b);
+	if ((buf = malloc(COPYSIZE)) == 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (;;) {
+		pthread_mutex_lock(&filelock);
+		i = nextfile++;
+		pthread_mutex_unlock(&filelock);
+		if (i >= nfiles)
+			break;
+		copyfile(files[i], buf);
+	}
+	free(buf);
+	return 0;
 }
 
 void
-flushdisk(void)
+writedata(void)
 {
+	pthread_t tid[MAXTHREADS];
 	int i;
 
-	for (i = 0; i < nelem(cache); i++)
-		if (cache[i].used)
-			flushb(&cache[i]);
+	if (nthreads == 1) {
+		copythread(0);
+		return;
+	}
+	for (i = 0; i < nthreads; i++)
+		if ((errno = pthread_create(&tid[i], 0, copythread, 0)) != 0)
+			fail("create", "thread");
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tid[i], 0);
 }
 
 void
 usage(void)
 {
-	fprintf(stderr, "Usage: fsformat kern/fs.img NBLOCKS files...\n\
-       fsformat kern/fs.img NBLOCKS -r DIR\n");
-	abort();
+	fprintf(stderr, "Usage: fsformat [options] kern/fs.img NBLOCKS files...\n\
+       fsformat [options] kern/fs.img NBLOCKS -r DIR\n\
+  -x  map files by extents\n\
+  -j  reserve NJOURNAL blocks for a metadata journal\n\
+  -s  stripe the file system across NDISKS disks, kern/fs.img and\n\
+      kern/fs.img.1 on\n\
+  -m  mirror the file system on NDISKS disks, likewise\n\
+  -u  blocks per stripe unit (default 4)\n\
+  -p  copy files with NTHREADS threads\n");
+	exit(2);
 }
 
 int
@@ -466,27 +582,68 @@ main(int argc, char **argv)
 
 	assert(BLKSIZE % sizeof(struct File) == 0);
 
+	while (argc > 1 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-x") == 0)
+			extfs = 1;
+		else if (strcmp(argv[1], "-j") == 0 && argc > 2) {
+			njournal = strtol(argv[2], &s, 0);
+			if (*s || s == argv[2] || njournal < 4
+			    || njournal > JOURNAL_MAXBLOCKS)
+				usage();
+			argc--;
+			argv++;
+		} else if ((strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-m") == 0)
+			   && argc > 2) {
+			diskmode = argv[1][1] == 's' ? FS_DISK_STRIPE : FS_DISK_MIRROR;
+			ndisks = strtol(argv[2], &s, 0);
+			if (*s || s == argv[2] || ndisks < 1 || ndisks > FS_MAXDISKS)
+				usage();
+			argc--;
+			argv++;
+		} else if (strcmp(argv[1], "-u") == 0 && argc > 2) {
+			// The superblock must lie in member 0's first unit
+			stripeunit = strtol(argv[2], &s, 0);
+			if (*s || s == argv[2] || stripeunit < 2 || stripeunit > 256)
+				usage();
+			argc--;
+			argv++;
+		} else if (strcmp(argv[1], "-p") == 0 && argc > 2) {
+			nthreads = strtol(argv[2], &s, 0);
+			if (*s || s == argv[2] || nthreads < 1 || nthreads > MAXTHREADS)
+				usage();
+			argc--;
+			argv++;
+		} else
+			usage();
+		argc--;
+		argv++;
+	}
 	if (argc < 3)
 		usage();
 
 	nblocks = strtol(argv[2], &s, 0);
-	if (*s || s == argv[2] || nblocks < 2 || nblocks > 1024)
+	if (*s || s == argv[2] || nblocks < 2 || nblocks > MAXNBLOCKS)
 		usage();
-	
-	opendisk(argv[1]);
+	if (ndisks == 1)
+		diskmode = FS_DISK_SINGLE;
 
-	if (strcmp(argv[3], "-r") == 0) {
+	if (argc > 3 && strcmp(argv[3], "-r") == 0) {
 		if (argc != 5)
 			usage();
-		writedirectory(&super.s_root, argv[4], 1);
+		adddirectory(&root, argv[4], 1);
 	} else {
 		for (i = 3; i < argc; i++)
-			writefile(&super.s_root, argv[i]);
+			addfile(&root, argv[i]);
 	}
-	
-	finishfs();
-	flushdisk();
+
+	layout();
+	opendisks(argv[1]);
+	writemeta();
+	writedata();
+
+	for (i = 0; i < ndisks; i++)
+		if (close(diskfd[i]) < 0)
+			fail("close", argv[1]);
 	exit(0);
 	return 0;
 }
-
@@ -2,6 +2,9 @@
  * Minimal PIO-based (non-interrupt-driven) IDE driver code.
  * For information about what all this IDE/ATA magic means,
  * see the materials available on the class references page.
+ *
+ * Disks are numbered 0-3: the master and slave of the primary channel
+ * (ports 0x1F0-0x1F7), then those of the secondary channel (0x170-0x177).
  */
 
 #include "fs.h"
@@ -12,100 +15,146 @@
 #define IDE_DF		0x20
 #define IDE_ERR		0x01
 
-static int diskno = 1;
+// A channel takes one command at a time, for either of its drives.
+// Commands queue up on it in arrival order; threads waiting their turn,
+// or for the drive, yield, so the file server keeps answering requests
+// that hit in the block cache, or go to the other channel, meanwhile.
+static struct IdeChannel {
+	uint16_t ic_base;
+	volatile uint32_t ic_next;	// next ticket to hand out
+	volatile uint32_t ic_serving;	// ticket whose command may run
+} channels[IDE_NCHANNEL] = {
+	{ 0x1F0 }, { 0x170 }
+};
+
+// Commands queued or running on each disk.
+static uint32_t queued[IDE_NDISK];
+
+static void
+ide_lock(int d)
+{
+	struct IdeChannel *ic = &channels[ide_channel(d)];
+	uint32_t ticket;
+
+	queued[d]++;
+	ticket = ic->ic_next++;
+	while (ic->ic_serving != ticket)
+		thread_wait(&ic->ic_serving, ic->ic_serving, (uint32_t) ~0);
+}
+
+static void
+ide_unlock(int d)
+{
+	struct IdeChannel *ic = &channels[ide_channel(d)];
+
+	queued[d]--;
+	ic->ic_serving++;
+	thread_wakeup(&ic->ic_serving);
+}
 
 static int
-ide_wait_ready(bool check_error)
+ide_wait_ready(int d, bool check_error)
 {
 	int r;
+	uint16_t base = channels[ide_channel(d)].ic_base;
 
-	while (((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
-		/* do nothing */;
+	while (((r = inb(base + 7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+		thread_yield();
 
 	if (check_error && (r & (IDE_DF|IDE_ERR)) != 0)
 		return -1;
 	return 0;
 }
 
-bool
-ide_probe_disk1(void)
+int
+ide_channel(int d)
 {
-	int r, x;
+	if (d < 0 || d >= IDE_NDISK)
+		panic("bad disk number %d", d);
+	return d >> 1;
+}
 
-	// wait for Device 0 to be ready
-	ide_wait_ready(0);
+// Number of commands queued or running on disk d.
+uint32_t
+ide_pending(int d)
+{
+	assert(d >= 0 && d < IDE_NDISK);
+	return queued[d];
+}
 
-	// switch to Device 1
-	outb(0x1F6, 0xE0 | (1<<4));
+bool
+ide_probe(int d)
+{
+	int r, x;
+	uint16_t base = channels[ide_channel(d)].ic_base;
 
-	// check for Device 1 to be ready for a while
-	for (x = 0; 
-           x < 1000 && ((r = inb(0x1F7)) & (IDE_BSY|IDE_DF|IDE_ERR)) != 0; 
-           x++)
-		/* do nothing */;
+	ide_lock(d);
+	outb(base + 6, 0xE0 | ((d&1)<<4));
 
-	// switch back to Device 0
-	outb(0x1F6, 0xE0 | (0<<4));
+	// check for the drive to be ready for a while; a channel with
+	// nothing on it floats the status register to 0xFF or 0
+	for (x = 0; x < 1000; x++)
+		if (((r = inb(base + 7)) & (IDE_BSY|IDE_DRDY|IDE_DF|IDE_ERR))
+		    == IDE_DRDY)
+			break;
 
-	//cprintf("Device 1 presence: %d\n", (x < 1000));
+	ide_unlock(d);
 	return (x < 1000);
 }
 
+// Queue up on d's channel and issue a read or write of nsecs sectors.
+// The channel is the caller's until ide_finish.
 void
-ide_set_disk(int d)
+ide_start(int d, uint32_t secno, size_t nsecs, bool write)
 {
-	if (d != 0 && d != 1)
-		panic("bad disk number");
-	diskno = d;
-}
-
-int
-ide_read(uint32_t secno, void *dst, size_t nsecs)
-{
-	int r;
-
-	assert(nsecs <= 256);
+	uint16_t base = channels[ide_channel(d)].ic_base;
 
-	ide_wait_ready(0);
+	assert(nsecs > 0 && nsecs <= 256);
 
-	outb(0x1F2, nsecs);
-	outb(0x1F3, secno & 0xFF);
-	outb(0x1F4, (secno >> 8) & 0xFF);
-	outb(0x1F5, (secno >> 16) & 0xFF);
-	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x20);	// CMD 0x20 means read sector
+	ide_lock(d);
+	outb(base + 6, 0xE0 | ((d&1)<<4));
+	ide_wait_ready(d, 0);
 
-	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
-		if ((r = ide_wait_ready(1)) < 0)
-			return r;
-		insl(0x1F0, dst, SECTSIZE/4);
-	}
-	
-	return 0;
+	outb(base + 2, nsecs & 0xFF);	// 0 means 256
+	outb(base + 3, secno & 0xFF);
+	outb(base + 4, (secno >> 8) & 0xFF);
+	outb(base + 5, (secno >> 16) & 0xFF);
+	outb(base + 6, 0xE0 | ((d&1)<<4) | ((secno>>24)&0x0F));
+	outb(base + 7, write ? 0x30 : 0x20);	// CMD 0x30 write, 0x20 read
 }
 
+// Move the data of the command ide_start issued on d, and give the
+// channel to the next command.
 int
-ide_write(uint32_t secno, const void *src, size_t nsecs)
+ide_finish(int d, void *buf, size_t nsecs, bool write)
 {
 	int r;
-	
-	assert(nsecs <= 256);
-
-	ide_wait_ready(0);
-
-	outb(0x1F2, nsecs);
-	outb(0x1F3, secno & 0xFF);
-	outb(0x1F4, (secno >> 8) & 0xFF);
-	outb(0x1F5, (secno >> 16) & 0xFF);
-	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x30);	// CMD 0x30 means write sector
-
-	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
-		if ((r = ide_wait_ready(1)) < 0)
-			return r;
-		outsl(0x1F0, src, SECTSIZE/4);
+	uint16_t base = channels[ide_channel(d)].ic_base;
+
+	r = 0;
+	for (; nsecs > 0; nsecs--, buf += SECTSIZE) {
+		if ((r = ide_wait_ready(d, 1)) < 0)
+			break;
+		if (write)
+			outsl(base, buf, SECTSIZE/4);
+		else
+			insl(base, buf, SECTSIZE/4);
 	}
 
-	return 0;
+	ide_unlock(d);
+	return r;
+}
+
+int
+ide_read(int d, uint32_t secno, void *dst, size_t nsecs)
+{
+	ide_start(d, secno, nsecs, 0);
+	return ide_finish(d, dst, nsecs, 0);
 }
 
+int
+ide_write(int d, uint32_t secno, const void *src, size_t nsecs)
+{
+	ide_start(d, secno, nsecs, 1);
+	return ide_finish(d, (void *) src, nsecs, 1);
+}
@@ -0,0 +1,244 @@
+/*
+ * Metadata journal.
+ *
+ * On file systems with a journal region, metadata blocks -- the
+ * superblock, the bitmap, directory blocks and indirect/extent blocks --
+ * are not written in place as they change.  journal_commit writes all
+ * dirty metadata blocks to the log as one transaction, a sequential
+ * write that either lands completely (its commit block is on disk) or
+ * is ignored.  Only when the log fills up are the logged blocks copied
+ * to their homes (a checkpoint), after which the log starts over.
+ * journal_init redoes the committed transactions left by a crash.
+ */
+
+#include <inc/x86.h>
+#include <inc/string.h>
+
+#include "fs.h"
+
+#define debug 0
+
+static uint32_t metamap[DISKSIZE / BLKSIZE / 32];	// metadata blocks
+
+// Blocks logged since the last checkpoint, and where in the log the
+// latest copy of each one is.
+static struct {
+	uint32_t l_bno;
+	uint32_t l_pos;
+} logged[JOURNAL_MAXBLOCKS];
+static uint32_t nlogged;
+
+// Blocks freed while logged.  They are not reused before the next
+// checkpoint, so replaying the log can never clobber a reused block.
+static uint32_t pendfree[JOURNAL_MAXBLOCKS];
+static uint32_t npendfree;
+
+static uint32_t jpos;		// next free block in the log
+static uint32_t jseq;		// sequence number of the next transaction
+
+static struct JournalDesc jdesc;
+static char jbuf[BLKSIZE];
+
+static int
+journal_io(bool write, uint32_t blockno, void *buf)
+{
+	if (write)
+		return disk_write(blockno, buf);
+	return disk_read(blockno, buf);
+}
+
+// Note that 'blockno' holds metadata.
+void
+journal_meta(uint32_t blockno)
+{
+	metamap[blockno / 32] |= 1 << (blockno % 32);
+}
+
+bool
+journal_is_meta(uint32_t blockno)
+{
+	return (metamap[blockno / 32] & (1 << (blockno % 32))) != 0;
+}
+
+// Called as 'blockno' is freed.  Returns 1 if the free must wait for
+// the next checkpoint, 0 if the block can be freed now.
+bool
+journal_free(uint32_t blockno)
+{
+	uint32_t i;
+
+	for (i = 0; i < nlogged; i++)
+		if (logged[i].l_bno == blockno) {
+			pendfree[npendfree++] = blockno;
+			return 1;
+		}
+	metamap[blockno / 32] &= ~(1 << (blockno % 32));
+	return 0;
+}
+
+// Start the log over with transaction 'jseq'.
+static void
+journal_reset(void)
+{
+	struct JournalHeader *jh = (struct JournalHeader*) jbuf;
+
+	memset(jbuf, 0, BLKSIZE);
+	jh->jh_magic = JHDR_MAGIC;
+	jh->jh_seq = jseq;
+	if (journal_io(1, super->s_journal, jbuf) < 0)
+		panic("journal: cannot write header");
+	jpos = 1;
+	nlogged = 0;
+}
+
+// Copy the latest committed version of every logged block home.
+static void
+journal_checkpoint(void)
+{
+	uint32_t i, bno, n;
+
+	for (i = 0; i < nlogged; i++) {
+		bno = logged[i].l_bno;
+		if (block_is_mapped(bno) && !block_is_dirty(bno)) {
+			// The cached copy is what was committed
+			if (journal_io(1, bno, diskaddr(bno)) < 0)
+				panic("journal: checkpoint write error");
+			continue;
+		}
+		if (journal_io(0, super->s_journal + logged[i].l_pos, jbuf) < 0
+		    || journal_io(1, bno, jbuf) < 0)
+			panic("journal: checkpoint I/O error");
+	}
+	if (debug)
+		cprintf("journal: checkpointed %d blocks\n", nlogged);
+	journal_reset();
+
+	n = npendfree;
+	npendfree = 0;
+	for (i = 0; i < n; i++)
+		free_block(pendfree[i]);
+}
+
+// Log the n blocks listed in jdesc as one transaction.
+static void
+journal_write(uint32_t n)
+{
+	struct JournalCommit *jc = (struct JournalCommit*) jbuf;
+	uint32_t i, j, bno, pos;
+	char *addr;
+
+	if (jpos + n + 2 > super->s_njournal)
+		journal_checkpoint();
+
+	jdesc.jd_magic = JDESC_MAGIC;
+	jdesc.jd_seq = jseq;
+	jdesc.jd_nblocks = n;
+	if (journal_io(1, super->s_journal + jpos, &jdesc) < 0)
+		panic("journal: write error");
+	for (i = 0; i < n; i++) {
+		bno = jdesc.jd_blocks[i];
+		pos = jpos + 1 + i;
+		addr = diskaddr(bno);
+		if (journal_io(1, super->s_journal + pos, addr) < 0)
+			panic("journal: write error");
+		// Clear PTE_D, as write_block does
+		sys_page_map(0, addr, 0, addr, PTE_USER);
+
+		for (j = 0; j < nlogged; j++)
+			if (logged[j].l_bno == bno)
+				break;
+		if (j == nlogged)
+			logged[nlogged++].l_bno = bno;
+		logged[j].l_pos = pos;
+	}
+
+	memset(jbuf, 0, BLKSIZE);
+	jc->jc_magic = JCOMMIT_MAGIC;
+	jc->jc_seq = jseq;
+	if (journal_io(1, super->s_journal + jpos + 1 + n, jbuf) < 0)
+		panic("journal: write error");
+
+	if (debug)
+		cprintf("journal: committed %d blocks as transaction %d\n",
+			n, jseq);
+	jpos += n + 2;
+	jseq++;
+}
+
+// Write every dirty metadata block to the log.
+void
+journal_commit(void)
+{
+	uint32_t w, bits, bno, n, max;
+
+	max = MIN(JDESC_MAXBLOCKS, super->s_njournal - 3);
+	n = 0;
+	for (w = 0; w < ROUNDUP(super->s_nblocks, 32) / 32; w++)
+		for (bits = metamap[w]; bits; bits &= bits - 1) {
+			bno = w * 32 + bsf(bits);
+			if (!block_is_dirty(bno))
+				continue;
+			// A transaction too big for the log is split, giving
+			// up atomicity rather than failing the sync.
+			if (n == max) {
+				journal_write(n);
+				n = 0;
+			}
+			jdesc.jd_blocks[n++] = bno;
+		}
+	if (n > 0)
+		journal_write(n);
+}
+
+// Redo the transactions committed before a crash, then start a fresh log.
+void
+journal_init(void)
+{
+	struct JournalHeader *jh = (struct JournalHeader*) jbuf;
+	struct JournalCommit *jc = (struct JournalCommit*) jbuf;
+	uint32_t i, n, pos, bno, ntrans;
+
+	if (super->s_njournal < 4 || super->s_njournal > JOURNAL_MAXBLOCKS)
+		panic("journal: bad journal size %d", super->s_njournal);
+	if (journal_io(0, super->s_journal, jbuf) < 0
+	    || jh->jh_magic != JHDR_MAGIC)
+		panic("journal: bad journal header");
+
+	jseq = jh->jh_seq;
+	ntrans = 0;
+	for (pos = 1; pos + 2 <= super->s_njournal; pos += n + 2) {
+		if (journal_io(0, super->s_journal + pos, &jdesc) < 0
+		    || jdesc.jd_magic != JDESC_MAGIC || jdesc.jd_seq != jseq
+		    || jdesc.jd_nblocks > JDESC_MAXBLOCKS
+		    || pos + jdesc.jd_nblocks + 2 > super->s_njournal)
+			break;
+		n = jdesc.jd_nblocks;
+		if (journal_io(0, super->s_journal + pos + 1 + n, jbuf) < 0
+		    || jc->jc_magic != JCOMMIT_MAGIC || jc->jc_seq != jseq)
+			break;
+
+		for (i = 0; i < n; i++) {
+			bno = jdesc.jd_blocks[i];
+			if (bno >= super->s_nblocks)
+				panic("journal: bad block %08x", bno);
+			if (journal_io(0, super->s_journal + pos + 1 + i, jbuf) < 0
+			    || journal_io(1, bno, jbuf) < 0)
+				panic("journal: replay I/O error");
+			// Refresh cached copies (the superblock)
+			if (block_is_mapped(bno)) {
+				memmove(diskaddr(bno), jbuf, BLKSIZE);
+				sys_page_map(0, diskaddr(bno), 0, diskaddr(bno),
+					     PTE_USER);
+			}
+		}
+		jseq++;
+		ntrans++;
+	}
+	if (ntrans > 0)
+		cprintf("fs: replayed %d journal transactions\n", ntrans);
+
+	journal_reset();
+	journal_meta(1);
+	for (i = 0; i * BLKBITSIZE < super->s_nblocks; i++)
+		journal_meta(2 + i);
+}
@@ -15,53 +15,215 @@ struct OpenFile {
 	struct File *o_file;	// mapped descriptor for open file
 	int o_mode;		// open mode
 	struct Fd *o_fd;	// Fd page
+	off_t o_reserved;	// size the client may grow the file to itself
+	struct Client *o_client;	// who is charged for it, 0 if free
+	struct OpenFile *o_next;	// on the free list or the client's list
+	struct OpenFile *o_prev;
 };
 
 // Max number of open files in the file system at once
 #define MAXOPEN		1024
 #define FILEVA		0xD0000000
 
+// Max number of open files charged to one client; see FS_CLIENTOPEN in
+// conf/env.mk.  By default one client may use the whole table.
+#ifndef FS_CLIENTOPEN
+#define FS_CLIENTOPEN	MAXOPEN
+#endif
+#define MAXCLIENTOPEN	MIN(FS_CLIENTOPEN, MAXOPEN)
+
 // initialize to force into data section
 struct OpenFile opentab[MAXOPEN] = {
 	{ 0, 0, 1, 0 }
 };
 
+// Free entries are kept on a list, and entries in use on a list per
+// client environment, so opening a file does not have to search the
+// table.  An entry is freed when the last environment sharing its Fd
+// page closes it.  Entries of clients that died without closing their
+// files are taken back by client_reap; the ones whose Fd page was
+// passed on to live environments move to the orphans list until those
+// let go of it too.
+struct Client {
+	envid_t c_envid;		// 0 if unused
+	struct OpenFile *c_files;
+	int c_nopen;
+};
+
+static struct Client clients[NENV];
+static struct Client orphans;
+static struct OpenFile *openfile_freelist;
+static uint32_t reap_hand;		// next client checked for death
+
 // Virtual address at which to receive page mappings containing client requests.
+// Worker i takes its requests at REQVA - i*PGSIZE.
 #define REQVA		0x0ffff000
 
+// Requests are served by a pool of threads, so one that waits for the
+// disk does not hold up those that can be answered from the block cache.
+#define NWORKER		8
+
+struct Worker {
+	thread_id_t w_tid;
+	volatile uint32_t w_req;	// request being served, 0 if idle
+	envid_t w_whom;
+	uint64_t w_start;		// when the request came in (TSC)
+	void *w_va;			// where the request page is mapped
+	// Thread stacks are one page, so big buffers live here
+	uintptr_t w_blkva[MAXMAPPAGES];
+	char w_path[MAXPATHLEN];
+};
+
+static struct Worker workers[NWORKER];
+static uint32_t nbusy;
+
+// Latency of the requests served so far, by request code
+static struct FsLatency fslat[NFSREQ];
+
+static struct Worker *
+worker_self(void)
+{
+	int i;
+	thread_id_t tid = thread_id();
+
+	for (i = 0; i < NWORKER; i++)
+		if (workers[i].w_tid == tid)
+			return &workers[i];
+	panic("worker_self: not a worker thread");
+}
+
+static struct Worker *
+worker_idle(void)
+{
+	int i;
+
+	for (i = 0; i < NWORKER; i++)
+		if (!workers[i].w_req)
+			return &workers[i];
+	return 0;
+}
+
 void
 serve_init(void)
 {
 	int i;
 	uintptr_t va = FILEVA;
-	for (i = 0; i < MAXOPEN; i++) {
+	for (i = MAXOPEN - 1; i >= 0; i--) {
 		opentab[i].o_fileid = i;
-		opentab[i].o_fd = (struct Fd*) va;
-		va += PGSIZE;
+		opentab[i].o_fd = (struct Fd*) (va + i * PGSIZE);
+		opentab[i].o_next = openfile_freelist;
+		openfile_freelist = &opentab[i];
 	}
 }
 
-// Allocate an open file.
-int
-openfile_alloc(struct OpenFile **o)
+static void
+client_uncharge(struct OpenFile *o)
 {
-	int i, r;
+	struct Client *c = o->o_client;
+
+	if (o->o_prev)
+		o->o_prev->o_next = o->o_next;
+	else
+		c->c_files = o->o_next;
+	if (o->o_next)
+		o->o_next->o_prev = o->o_prev;
+	c->c_nopen--;
+	o->o_client = 0;
+	o->o_prev = 0;
+}
+
+static void
+client_charge(struct Client *c, struct OpenFile *o)
+{
+	o->o_client = c;
+	o->o_prev = 0;
+	o->o_next = c->c_files;
+	if (c->c_files)
+		c->c_files->o_prev = o;
+	c->c_files = o;
+	c->c_nopen++;
+}
 
-	// Find an available open-file table entry
-	for (i = 0; i < MAXOPEN; i++) {
-		switch (pageref(opentab[i].o_fd)) {
-		case 0:
-			if ((r = sys_page_alloc(0, opentab[i].o_fd, PTE_P|PTE_U|PTE_W) < 0))
-				return r;
-			/* fall through */
-		case 1:
-			opentab[i].o_fileid += MAXOPEN;
-			*o = &opentab[i];
-			memset(opentab[i].o_fd, 0, PGSIZE);
-			return (*o)->o_fileid;
+// Put an open file back on the free list.
+void
+openfile_free(struct OpenFile *o)
+{
+	client_uncharge(o);
+	o->o_next = openfile_freelist;
+	openfile_freelist = o;
+}
+
+static bool
+client_dead(struct Client *c)
+{
+	volatile struct Env *e = &envs[ENVX(c->c_envid)];
+
+	return e->env_id != c->c_envid || e->env_status == ENV_FREE;
+}
+
+// Free the entries of client c that no environment uses any more, and
+// if c is dead, hand the rest to the orphans and forget c.
+static void
+client_reap(struct Client *c)
+{
+	struct OpenFile *o, *next;
+	bool dead = c != &orphans && client_dead(c);
+
+	for (o = c->c_files; o; o = next) {
+		next = o->o_next;
+		if (pageref(o->o_fd) <= 1)
+			openfile_free(o);
+		else if (dead) {
+			client_uncharge(o);
+			client_charge(&orphans, o);
 		}
 	}
-	return -E_MAX_OPEN;
+	if (dead)
+		c->c_envid = 0;
+}
+
+// Allocate an open file for client envid.
+int
+openfile_alloc(envid_t envid, struct OpenFile **o)
+{
+	int i, r;
+	struct Client *c;
+
+	// Check one client per call, so the entries of dead clients
+	// come back even while the free list is not empty.
+	c = &clients[reap_hand++ % NENV];
+	if (c->c_envid && client_dead(c))
+		client_reap(c);
+
+	c = &clients[ENVX(envid)];
+	if (c->c_envid != envid) {
+		if (c->c_envid)
+			client_reap(c);
+		c->c_envid = envid;
+	}
+	if (c->c_nopen >= MAXCLIENTOPEN)
+		client_reap(c);
+	if (c->c_nopen >= MAXCLIENTOPEN)
+		return -E_MAX_OPEN;
+
+	if (!openfile_freelist) {
+		for (i = 0; i < NENV; i++)
+			if (clients[i].c_envid && client_dead(&clients[i]))
+				client_reap(&clients[i]);
+		client_reap(&orphans);
+		if (!openfile_freelist)
+			return -E_MAX_OPEN;
+	}
+
+	*o = openfile_freelist;
+	if (pageref((*o)->o_fd) == 0
+	    && (r = sys_page_alloc(0, (*o)->o_fd, PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	openfile_freelist = (*o)->o_next;
+	client_charge(c, *o);
+	(*o)->o_fileid += MAXOPEN;
+	memset((*o)->o_fd, 0, PGSIZE);
+	return (*o)->o_fileid;
 }
 
 // Look up an open file for envid.
@@ -71,19 +233,46 @@ openfile_lookup(envid_t envid, uint32_t fileid, struct OpenFile **po)
 	struct OpenFile *o;
 
 	o = &opentab[fileid % MAXOPEN];
-	if (pageref(o->o_fd) == 1 || o->o_fileid != fileid)
+	if (!o->o_client || o->o_fileid != fileid)
 		return -E_INVAL;
 	*po = o;
 	return 0;
 }
 
+// A client may grow a file into blocks reserved for it by just setting
+// the size in its Fd page (see file_write in lib/file.c).  Take that
+// size up before doing anything that depends on it, but no further than
+// the reservation: the Fd page is the client's to write.
+static int
+openfile_adopt_size(struct OpenFile *o)
+{
+	off_t size = MIN(o->o_fd->fd_file.file.f_size, o->o_reserved);
+
+	if (size <= o->o_file->f_size || !(o->o_mode & (O_WRONLY|O_RDWR)))
+		return 0;
+	return file_set_size(o->o_file, size);
+}
+
+// File f has been cut down to 'size' bytes, and its blocks past there
+// are gone.  No open file may grow it back over them without asking.
+static void
+openfile_unreserve(struct File *f, off_t size)
+{
+	int i;
+
+	for (i = 0; i < MAXOPEN; i++)
+		if (opentab[i].o_client && opentab[i].o_file == f
+		    && opentab[i].o_reserved > size)
+			opentab[i].o_reserved = size;
+}
+
 // Serve requests, sending responses back to envid.
 // To send a result back, ipc_send(envid, r, 0, 0).
 // To include a page, ipc_send(envid, r, srcva, perm).
 void
 serve_open(envid_t envid, struct Fsreq_open *rq)
 {
-	char path[MAXPATHLEN];
+	char *path = worker_self()->w_path;
 	struct File *f;
 	int fileid;
 	int r;
@@ -97,22 +286,43 @@ serve_open(envid_t envid, struct Fsreq_open *rq)
 	path[MAXPATHLEN-1] = 0;
 
 	// Find an open file ID
-	if ((r = openfile_alloc(&o)) < 0) {
+	if ((r = openfile_alloc(envid, &o)) < 0) {
 		if (debug)
 			cprintf("openfile_alloc failed: %e", r);
 		goto out;
 	}
 	fileid = r;
 
-	// Open the file
-	if ((r = file_open(path, &f)) < 0) {
+	// Open the file, creating it if asked to
+	if (rq->req_omode & O_CREAT) {
+		r = file_create(path, &f);
+		if (r == 0 && (rq->req_omode & O_MKDIR))
+			f->f_type = FTYPE_DIR;
+		if (r == -E_FILE_EXISTS && !(rq->req_omode & O_EXCL))
+			r = file_open(path, &f);
+	} else
+		r = file_open(path, &f);
+	if (r < 0) {
 		if (debug)
 			cprintf("file_open failed: %e", r);
+		openfile_free(o);
 		goto out;
 	}
 
+	if (rq->req_omode & O_TRUNC) {
+		if (f->f_type == FTYPE_DIR)
+			r = -E_INVAL;
+		else if ((r = file_set_size(f, 0)) == 0)
+			openfile_unreserve(f, 0);
+		if (r < 0) {
+			openfile_free(o);
+			goto out;
+		}
+	}
+
 	// Save the file pointer
 	o->o_file = f;
+	o->o_reserved = 0;
 
 	// Fill out the Fd structure
 	o->o_fd->fd_file.file = *f;
@@ -172,6 +382,7 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *rq)
 
 	if ((r = file_set_size(o->o_file, rq->req_size)) < 0)
 		goto out;
+	openfile_unreserve(o->o_file, rq->req_size);
 
 	o->o_fd->fd_file.file.f_size = rq->req_size;
 
@@ -190,7 +401,8 @@ serve_map(envid_t envid, struct Fsreq_map *rq)
 	if (debug)
 		cprintf("serve_map %08x %08x %08x\n", envid, rq->req_fileid, rq->req_offset);
 
-	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
+	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0
+	    || (r = openfile_adopt_size(o)) < 0)
 		goto out;
 
 	if ((r = file_get_block(o->o_file, rq->req_offset / BLKSIZE, &blk)) < 0)
@@ -204,10 +416,90 @@ out:
 	ipc_send(envid, r, 0, 0);
 }
 
+// Map a run of file blocks into the client with a single IPC.
+// The reply value is the number of pages sent, which may be less than
+// asked for if the run reaches the end of the file.
+void
+serve_map_range(envid_t envid, struct Fsreq_map_range *rq)
+{
+	uintptr_t *blkva = worker_self()->w_blkva;
+	int r, i, n;
+	char *blk;
+	struct OpenFile *o;
+	int perm;
+
+	if (debug)
+		cprintf("serve_map_range %08x %08x %08x %d\n", envid, rq->req_fileid, rq->req_offset, rq->req_npages);
+
+	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0
+	    || (r = openfile_adopt_size(o)) < 0)
+		goto out;
+
+	if (rq->req_offset % BLKSIZE || rq->req_npages <= 0
+	    || rq->req_npages > MAXMAPPAGES) {
+		r = -E_INVAL;
+		goto out;
+	}
+
+	n = rq->req_npages;
+	if (rq->req_offset + n * BLKSIZE > ROUNDUP(o->o_file->f_size, BLKSIZE))
+		n = (ROUNDUP(o->o_file->f_size, BLKSIZE) - rq->req_offset) / BLKSIZE;
+	if (n <= 0) {
+		r = -E_INVAL;
+		goto out;
+	}
+
+	// Prefetching and reading drop the fs lock, and another client may
+	// truncate the file meanwhile: stop at wherever its end is now
+	// rather than allocate blocks past it.
+	file_prefetch(o->o_file, rq->req_offset / BLKSIZE, n);
+	r = -E_INVAL;
+	for (i = 0; i < n; i++) {
+		if (rq->req_offset + i * BLKSIZE >= ROUNDUP(o->o_file->f_size, BLKSIZE)
+		    || (r = file_get_block(o->o_file, rq->req_offset / BLKSIZE + i, &blk)) < 0)
+			break;
+		blkva[i] = (uintptr_t) blk;
+	}
+	if (i == 0)
+		goto out;
+	n = i;
+
+	perm = o->o_mode & (O_WRONLY|O_RDWR) ? PTE_U|PTE_P|PTE_W : PTE_U|PTE_P;
+
+	ipc_send_pages(envid, n, blkva, n, perm | PTE_SHARE);
+	return;
+out:
+	ipc_send(envid, r, 0, 0);
+}
+
+// Reserve blocks for an open file up to req_size bytes.
+// The reply value is the number of bytes the file has blocks for.
+void
+serve_prealloc(envid_t envid, struct Fsreq_prealloc *rq)
+{
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_prealloc %08x %08x %08x\n", envid, rq->req_fileid, rq->req_size);
+
+	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
+		goto out;
+	if (!(o->o_mode & (O_WRONLY|O_RDWR))) {
+		r = -E_INVAL;
+		goto out;
+	}
+	if ((r = file_prealloc(o->o_file, rq->req_size)) >= 0)
+		o->o_reserved = r;
+out:
+	ipc_send(envid, r, 0, 0);
+}
+
 void
 serve_close(envid_t envid, struct Fsreq_close *rq)
 {
 	struct OpenFile *o;
+	bool last;
 	int r;
 
 	if (debug)
@@ -215,8 +507,18 @@ serve_close(envid_t envid, struct Fsreq_close *rq)
 	
 	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
 		goto out;
+	r = openfile_adopt_size(o);
+	// Clients unmap the Fd page before closing, so the entry can go
+	// once the server holds the only mapping.  Blocks reserved past
+	// the end of the file go with it.
+	last = (pageref(o->o_fd) == 1);
+	if (last && (o->o_mode & (O_WRONLY|O_RDWR))) {
+		file_trim(o->o_file);
+		openfile_unreserve(o->o_file, o->o_file->f_size);
+	}
 	file_close(o->o_file);
-	r = 0;
+	if (last)
+		openfile_free(o);
 	
   out:
 	ipc_send(envid, r, 0, 0);
@@ -225,7 +527,8 @@ serve_close(envid_t envid, struct Fsreq_close *rq)
 void
 serve_remove(envid_t envid, struct Fsreq_remove *rq)
 {
-	char path[MAXPATHLEN];
+	char *path = worker_self()->w_path;
+	struct File *f;
 	int r;
 
 	if (debug)
@@ -236,7 +539,8 @@ serve_remove(envid_t envid, struct Fsreq_remove *rq)
 	path[MAXPATHLEN-1] = 0;
 
 	// Delete the specified file
-	r = file_remove(path);
+	if ((r = file_open(path, &f)) == 0 && (r = file_remove(path)) == 0)
+		openfile_unreserve(f, 0);
 	ipc_send(envid, r, 0, 0);
 }
 
@@ -258,6 +562,57 @@ out:
 	ipc_send(envid, r, 0, 0);
 }
 
+// Return the attributes of a file without opening it.
+void
+serve_stat(envid_t envid, struct Fsreq_stat *rq)
+{
+	char *path = worker_self()->w_path;
+	struct File *f;
+	int r;
+
+	if (debug)
+		cprintf("serve_stat %08x %s\n", envid, rq->req_path);
+
+	memmove(path, rq->req_path, MAXPATHLEN);
+	path[MAXPATHLEN-1] = 0;
+
+	if ((r = file_open(path, &f)) < 0)
+		goto out;
+	strcpy(rq->ret_name, f->f_name);
+	rq->ret_size = f->f_size;
+	rq->ret_isdir = (f->f_type == FTYPE_DIR);
+out:
+	ipc_send(envid, r, 0, 0);
+}
+
+// Copy a batch of directory entries into the request page.
+// The reply value is the number of entries, 0 at the end.
+void
+serve_readdir(envid_t envid, struct Fsreq_readdir *rq)
+{
+	struct OpenFile *o;
+	uint32_t pos;
+	int r;
+
+	if (debug)
+		cprintf("serve_readdir %08x %08x %08x\n", envid, rq->req_fileid, rq->req_offset);
+
+	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
+		goto out;
+	if (rq->req_offset < 0 || rq->req_n < 0) {
+		r = -E_INVAL;
+		goto out;
+	}
+
+	pos = rq->req_offset / sizeof(struct File);
+	if ((r = dir_read(o->o_file, &pos, rq->ret_ents,
+			  MIN(rq->req_n, NDIRENT))) < 0)
+		goto out;
+	rq->req_offset = pos * sizeof(struct File);
+out:
+	ipc_send(envid, r, 0, 0);
+}
+
 void
 serve_sync(envid_t envid)
 {
@@ -265,57 +620,163 @@ serve_sync(envid_t envid)
 	ipc_send(envid, 0, 0, 0);
 }
 
+// Account a request of type req that took t cycles.
+static void
+fslat_record(uint32_t req, uint64_t t)
+{
+	struct FsLatency *fl = &fslat[req];
+	uint64_t v;
+	int i;
+
+	for (v = t >> FSLAT_SHIFT, i = 0; v && i < NFSLAT - 1; v >>= 1)
+		i++;
+	fl->fl_count++;
+	fl->fl_total += t;
+	if (t > fl->fl_max)
+		fl->fl_max = t > ~0U ? ~0U : t;
+	fl->fl_hist[i]++;
+}
+
 void
-serve(void)
+serve_stats(envid_t envid, struct Fsreq_stats *rq)
 {
-	uint32_t req, whom;
-	int perm;
-	
-	cprintf("FS: File System initialized\n");
-	while (1) {
-		perm = 0;
-		req = ipc_recv((int32_t *) &whom, (void *) REQVA, &perm);
-		if (debug)
-			cprintf("fs req %d from %08x [page %08x: %s]\n",
-				req, whom, vpt[VPN(REQVA)], REQVA);
+	memmove(rq->ret_lat, fslat, sizeof(fslat));
+	if (rq->req_reset)
+		memset(fslat, 0, sizeof(fslat));
+	ipc_send(envid, 0, 0, 0);
+}
 
-		// All requests must contain an argument page
-		if (!(perm & PTE_P)) {
-			cprintf("Invalid request from %08x: no argument page\n",
-				whom);
-			continue; // just leave it hanging...
-		}
+// Serve requests handed over by serve() in the worker w.
+void
+serve_worker(uint32_t arg)
+{
+	struct Worker *w = &workers[arg];
+	void *va = w->w_va;
 
-		switch (req) {
+	while (1) {
+		while (!w->w_req)
+			thread_wait(&w->w_req, 0, (uint32_t) ~0);
+
+		fs_lock();
+		switch (w->w_req) {
 		case FSREQ_OPEN:
-			serve_open(whom, (struct Fsreq_open*)REQVA);
+			serve_open(w->w_whom, (struct Fsreq_open*)va);
 			break;
 		case FSREQ_MAP:
-			serve_map(whom, (struct Fsreq_map*)REQVA);
+			serve_map(w->w_whom, (struct Fsreq_map*)va);
 			break;
 		case FSREQ_SET_SIZE:
-			serve_set_size(whom, (struct Fsreq_set_size*)REQVA);
+			serve_set_size(w->w_whom, (struct Fsreq_set_size*)va);
 			break;
 		case FSREQ_CLOSE:
-			serve_close(whom, (struct Fsreq_close*)REQVA);
+			serve_close(w->w_whom, (struct Fsreq_close*)va);
 			break;
 		case FSREQ_DIRTY:
-			serve_dirty(whom, (struct Fsreq_dirty*)REQVA);
+			serve_dirty(w->w_whom, (struct Fsreq_dirty*)va);
 			break;
 		case FSREQ_REMOVE:
-			serve_remove(whom, (struct Fsreq_remove*)REQVA);
+			serve_remove(w->w_whom, (struct Fsreq_remove*)va);
 			break;
 		case FSREQ_SYNC:
-			serve_sync(whom);
+			serve_sync(w->w_whom);
+			break;
+		case FSREQ_MAP_RANGE:
+			serve_map_range(w->w_whom, (struct Fsreq_map_range*)va);
+			break;
+		case FSREQ_STAT:
+			serve_stat(w->w_whom, (struct Fsreq_stat*)va);
+			break;
+		case FSREQ_READDIR:
+			serve_readdir(w->w_whom, (struct Fsreq_readdir*)va);
+			break;
+		case FSREQ_PREALLOC:
+			serve_prealloc(w->w_whom, (struct Fsreq_prealloc*)va);
+			break;
+		case FSREQ_STATS:
+			serve_stats(w->w_whom, (struct Fsreq_stats*)va);
 			break;
 		default:
-			cprintf("Invalid request code %d from %08x\n", whom, req);
+			cprintf("Invalid request code %d from %08x\n", w->w_whom, w->w_req);
 			break;
 		}
-		sys_page_unmap(0, (void*) REQVA);
+		fs_unlock();
+		if (w->w_req < NFSREQ && w->w_req != FSREQ_STATS)
+			fslat_record(w->w_req, read_tsc() - w->w_start);
+		sys_page_unmap(0, va);
+		w->w_req = 0;
+		nbusy--;
+	}
+}
+
+// Receive requests and hand each to an idle worker.  While a receive is
+// pending the other threads keep running; when none of them has work
+// the whole environment sleeps in sys_ipc_wait.
+void
+serve(void)
+{
+	struct Worker *w;
+	uint32_t req, whom;
+	int i, perm;
+	
+	for (i = 0; i < NWORKER; i++) {
+		workers[i].w_va = (void *) (REQVA - i * PGSIZE);
+		if (thread_create(&workers[i].w_tid, "fs worker",
+				  serve_worker, i) < 0)
+			panic("serve: cannot create worker threads");
+	}
+
+	cprintf("FS: File System initialized\n");
+	while (1) {
+		while (!(w = worker_idle()))
+			thread_yield();
+
+		if (sys_ipc_recv_nb(w->w_va) < 0)
+			panic("serve: cannot receive");
+		while (env->env_ipc_recving) {
+			if (nbusy == 0)
+				sys_ipc_wait();
+			else
+				thread_yield();
+		}
+		req = env->env_ipc_value;
+		whom = env->env_ipc_from;
+		perm = env->env_ipc_perm;
+		if (debug)
+			cprintf("fs req %d from %08x [page %08x: %s]\n",
+				req, whom, vpt[VPN(w->w_va)], w->w_va);
+
+		// All requests must contain an argument page
+		if (!(perm & PTE_P)) {
+			cprintf("Invalid request from %08x: no argument page\n",
+				whom);
+			continue; // just leave it hanging...
+		}
+		if (req == 0) {
+			cprintf("Invalid request code %d from %08x\n", whom, req);
+			sys_page_unmap(0, w->w_va);
+			continue;
+		}
+
+		w->w_whom = whom;
+		w->w_start = read_tsc();
+		w->w_req = req;
+		nbusy++;
+		thread_wakeup(&w->w_req);
+		thread_yield();
 	}
 }
 
+void
+main_thread(uint32_t arg)
+{
+	serve_init();
+	fs_lock();
+	fs_init();
+	//fs_test();
+	fs_unlock();
+	serve();
+}
+
 void
 umain(void)
 {
@@ -325,9 +786,8 @@ umain(void)
 	//outw(0x8A00, 0x8A00);
 	//cprintf("FS can do I/O\n");
 
-	serve_init();
-	fs_init();
-	//fs_test();
-	serve();
+	thread_init();
+	if (thread_create(0, "main", main_thread, 0) < 0)
+		panic("umain: cannot create main thread");
+	thread_yield();
 }
-
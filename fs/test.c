@@ -16,6 +16,88 @@ strecmp(char *a, char *b)
 
 static char *msg = "This is the NEW message of the day!\n\n";
 
+// Enough blocks, each its own extent, to spill out of the File into a
+// leaf block.
+#define EXTTEST_NBLOCKS	(NEXTENT + 4)
+
+static void
+exttest_check(struct File *f, int n)
+{
+	uint32_t bno;
+	char *blk;
+	int i, r;
+
+	assert(f->f_nblocks == n);
+	for (i = 0; i < n; i++) {
+		if ((r = file_map_block(f, i, &bno, 0)) < 0)
+			panic("file_map_block %d: %e", i, r);
+		if ((r = file_get_block(f, i, &blk)) < 0)
+			panic("file_get_block %d: %e", i, r);
+		assert(blk[0] == 'a' + i && blk[BLKSIZE - 1] == 'a' + i);
+	}
+	assert(file_map_block(f, n, &bno, 0) == -E_NOT_FOUND);
+}
+
+// Grow a file a block at a time, taking the disk block after each one
+// for ourselves first, so that every block starts a new extent; then
+// check the mapping survives a reopen and truncates back across NEXTENT.
+static void
+fs_test_extents(void)
+{
+	struct File *f;
+	uint32_t bno, stolen[EXTTEST_NBLOCKS];
+	char *blk;
+	int i, r;
+
+	if ((r = file_create("/exttest", &f)) < 0)
+		panic("file_create /exttest: %e", r);
+	for (i = 0; i < EXTTEST_NBLOCKS; i++) {
+		if ((r = file_get_block(f, i, &blk)) < 0)
+			panic("file_get_block %d: %e", i, r);
+		memset(blk, 'a' + i, BLKSIZE);
+		if ((r = file_map_block(f, i, &bno, 0)) < 0)
+			panic("file_map_block %d: %e", i, r);
+		if ((r = alloc_block_near(bno + 1)) < 0)
+			panic("alloc_block_near: %e", r);
+		stolen[i] = r;
+	}
+	if ((r = file_set_size(f, EXTTEST_NBLOCKS * BLKSIZE)) < 0)
+		panic("file_set_size: %e", r);
+	assert(f->f_nextent == EXTTEST_NBLOCKS && f->f_exttree != 0);
+	exttest_check(f, EXTTEST_NBLOCKS);
+	cprintf("extent grow is good\n");
+
+	file_flush(f);
+	file_close(f);
+	if ((r = file_open("/exttest", &f)) < 0)
+		panic("file_open /exttest: %e", r);
+	exttest_check(f, EXTTEST_NBLOCKS);
+	cprintf("extent reopen is good\n");
+
+	// Back to the extents in the File: the tree goes
+	if ((r = file_set_size(f, (NEXTENT - 1) * BLKSIZE)) < 0)
+		panic("file_set_size: %e", r);
+	assert(f->f_nextent == NEXTENT - 1 && f->f_exttree == 0);
+	exttest_check(f, NEXTENT - 1);
+	// and across it again
+	for (i = NEXTENT - 1; i < EXTTEST_NBLOCKS; i++) {
+		if ((r = file_get_block(f, i, &blk)) < 0)
+			panic("file_get_block %d: %e", i, r);
+		memset(blk, 'a' + i, BLKSIZE);
+	}
+	exttest_check(f, EXTTEST_NBLOCKS);
+	if ((r = file_set_size(f, 0)) < 0)
+		panic("file_set_size: %e", r);
+	assert(f->f_nextent == 0 && f->f_nblocks == 0 && f->f_exttree == 0);
+	cprintf("extent truncate is good\n");
+
+	file_close(f);
+	for (i = 0; i < EXTTEST_NBLOCKS; i++)
+		free_block(stolen[i]);
+	if ((r = file_remove("/exttest")) < 0)
+		panic("file_remove /exttest: %e", r);
+}
+
 void
 fs_test(void)
 {
@@ -62,7 +144,11 @@ fs_test(void)
 
 	if ((r = file_set_size(f, 0)) < 0)
 		panic("file_set_size: %e", r);
-	assert(f->f_direct[0] == 0);
+	if (super->s_magic == FS_MAGIC_EXT)
+		assert(f->f_nextent == 0 && f->f_nblocks == 0
+		       && f->f_extent[0].e_diskblk == 0);
+	else
+		assert(f->f_direct[0] == 0);
 	assert(!(vpt[VPN(f)] & PTE_D));
 	cprintf("file_truncate is good\n");
 
@@ -78,4 +164,7 @@ fs_test(void)
 	file_close(f);
 	assert(!(vpt[VPN(f)] & PTE_D));	
 	cprintf("file rewrite is good\n");
+
+	if (super->s_magic == FS_MAGIC_EXT)
+		fs_test_extents();
 }
@@ -55,9 +55,12 @@ struct Env {
 
 	bool env_ipc_recving;		// env is blocked receiving
 	void *env_ipc_dstva;		// va at which to map received page
+	int env_ipc_npages;		// pages accepted from env_ipc_dstva on;
+					// once received, the pages mapped there
 	uint32_t env_ipc_value;		// data value sent to us 
 	envid_t env_ipc_from;		// envid of the sender	
 	int env_ipc_perm;		// perm of page mapping received
+	uint32_t env_wakeup;		// msec a sleep in sys_ipc_wait ends at
 
 	struct Spinlock env_lock;	// mutual exclusion
 };
@@ -27,6 +27,8 @@ struct Dev {
 struct FdFile {
 	int id;
 	struct File file;
+	off_t reserved;		// the file has blocks up to here; the client
+				// may grow file.f_size this far on its own
 };
 
 struct Fd {
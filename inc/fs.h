@@ -4,6 +4,7 @@
 #define JOS_INC_FS_H
 
 #include <inc/types.h>
+#include <inc/mmu.h>
 
 // File nodes (both in-memory and on-disk)
 
@@ -25,15 +26,49 @@
 
 #define MAXFILESIZE	(NINDIRECT * BLKSIZE)
 
+// Extent-format (FS_MAGIC_EXT) file systems map file blocks by extents.
+// An extent maps file blocks [e_fileblk, next extent's e_fileblk) onto
+// the same number of consecutive disk blocks starting at e_diskblk; the
+// last extent runs up to f_nblocks.  Allocated file blocks always form a
+// prefix of the file, so extents are sorted and leave no holes.
+struct Extent {
+	uint32_t e_fileblk;		// first file block of the extent
+	uint32_t e_diskblk;		// disk block holding e_fileblk
+};
+
+// Number of extents kept in the File itself
+#define NEXTENT		4
+// Number of extents in an extent leaf block
+#define EXTPERBLK	(BLKSIZE / sizeof(struct Extent))
+// Number of leaf block pointers in the extent index block
+#define NEXTIDX		(BLKSIZE / 4)
+
+// Largest file an extent-format file system can hold; bounded by off_t
+#define MAXEXTFILESIZE	0x7FFFF000
+
 struct File {
 	char f_name[MAXNAMELEN];	// filename
 	off_t f_size;			// file size in bytes
 	uint32_t f_type;		// file type
 
-	// Block pointers.
-	// A block is allocated iff its value is != 0.
-	uint32_t f_direct[NDIRECT];	// direct blocks
-	uint32_t f_indirect;		// indirect block
+	union {
+		// Block pointers.
+		// A block is allocated iff its value is != 0.
+		struct {
+			uint32_t f_direct[NDIRECT];	// direct blocks
+			uint32_t f_indirect;		// indirect block
+		};
+
+		// Extents, on FS_MAGIC_EXT file systems.
+		// Extents past the first NEXTENT live in leaf blocks
+		// listed by the index block f_exttree.
+		struct {
+			struct Extent f_extent[NEXTENT];
+			uint32_t f_nextent;		// extents in use
+			uint32_t f_nblocks;		// allocated file blocks
+			uint32_t f_exttree;		// extent index block
+		};
+	};
 
 	// Points to the directory in which this file lives.
 	// Meaningful only in memory; the value on disk can be garbage.
@@ -56,11 +91,52 @@ struct File {
 // File system super-block (both in-memory and on-disk)
 
 #define FS_MAGIC	0x4A0530AE	// related vaguely to 'J\0S!'
+#define FS_MAGIC_EXT	0x4A0530AF	// same, but files are mapped by extents
 
 struct Super {
-	uint32_t s_magic;		// Magic number: FS_MAGIC
+	uint32_t s_magic;		// Magic number: FS_MAGIC or FS_MAGIC_EXT
 	uint32_t s_nblocks;		// Total number of blocks on disk
 	struct File s_root;		// Root directory node
+	uint32_t s_journal;		// First block of the journal, or 0
+	uint32_t s_njournal;		// Blocks in the journal
+	uint32_t s_diskmode;		// FS_DISK_SINGLE, _STRIPE or _MIRROR
+	uint32_t s_ndisks;		// Member disks when striped or mirrored
+	uint32_t s_stripe;		// Blocks per stripe unit
+};
+
+// How a file system spans several disks.  Striped, block b is in stripe
+// unit u = b / s_stripe, which is on member u % s_ndisks; mirrored,
+// every member holds every block.  Members are IDE disks 1, 2 and 3,
+// in order.
+#define FS_DISK_SINGLE	0
+#define FS_DISK_STRIPE	1
+#define FS_DISK_MIRROR	2
+#define FS_MAXDISKS	3
+
+// Metadata journal.  Block 0 of the journal region holds a
+// JournalHeader; transactions follow it, each a JournalDesc block,
+// the jd_nblocks logged blocks, and a JournalCommit block.
+#define JOURNAL_MAXBLOCKS	1024
+#define JHDR_MAGIC	0x4A4E4C48	// 'JNLH'
+#define JDESC_MAGIC	0x4A4E4C44	// 'JNLD'
+#define JCOMMIT_MAGIC	0x4A4E4C43	// 'JNLC'
+#define JDESC_MAXBLOCKS	((BLKSIZE - 12) / 4)
+
+struct JournalHeader {
+	uint32_t jh_magic;
+	uint32_t jh_seq;		// sequence number of the first transaction
+};
+
+struct JournalDesc {
+	uint32_t jd_magic;
+	uint32_t jd_seq;
+	uint32_t jd_nblocks;
+	uint32_t jd_blocks[JDESC_MAXBLOCKS];	// home of each logged block
+};
+
+struct JournalCommit {
+	uint32_t jc_magic;
+	uint32_t jc_seq;
 };
 
 // Definitions for requests from clients to file system
@@ -72,6 +148,15 @@ struct Super {
 #define FSREQ_DIRTY	5
 #define FSREQ_REMOVE	6
 #define FSREQ_SYNC	7
+#define FSREQ_MAP_RANGE	8
+#define FSREQ_STAT	9
+#define FSREQ_READDIR	10
+#define FSREQ_PREALLOC	11
+#define FSREQ_STATS	12
+#define NFSREQ		13	// request codes are below this
+
+// Most block pages a single FSREQ_MAP_RANGE request can return
+#define MAXMAPPAGES	(BLKSIZE / 4)
 
 struct Fsreq_open {
 	char req_path[MAXPATHLEN];
@@ -83,11 +168,22 @@ struct Fsreq_map {
 	off_t req_offset;
 };
 
+struct Fsreq_map_range {
+	int req_fileid;
+	off_t req_offset;
+	int req_npages;
+};
+
 struct Fsreq_set_size {
 	int req_fileid;
 	off_t req_size;
 };
 
+struct Fsreq_prealloc {
+	int req_fileid;
+	off_t req_size;
+};
+
 struct Fsreq_close {
 	int req_fileid;
 };
@@ -101,4 +197,51 @@ struct Fsreq_remove {
 	char req_path[MAXPATHLEN];
 };
 
+// The server answers FSREQ_STAT and FSREQ_READDIR by filling in the
+// rest of the request page, which the client shares with it.
+struct Fsreq_stat {
+	char req_path[MAXPATHLEN];
+	char ret_name[MAXNAMELEN];
+	off_t ret_size;
+	int ret_isdir;
+};
+
+// A directory entry as returned by FSREQ_READDIR
+struct Dirent {
+	char d_name[MAXNAMELEN];
+	off_t d_size;
+	int d_type;
+};
+
+// Most entries a single FSREQ_READDIR request can return
+#define NDIRENT		((PGSIZE - 12) / sizeof(struct Dirent))
+
+struct Fsreq_readdir {
+	int req_fileid;
+	off_t req_offset;	// byte offset in the directory, updated
+				// past the last entry returned
+	int req_n;
+	struct Dirent ret_ents[NDIRENT];
+};
+
+// Latency of one kind of request, in TSC cycles from its arrival at the
+// server to the end of its handling.  Bucket 0 of the histogram counts
+// requests served in under 2^FSLAT_SHIFT cycles, bucket i > 0 those that
+// took [2^(FSLAT_SHIFT+i-1), 2^(FSLAT_SHIFT+i)); the last bucket also
+// counts everything slower.
+#define FSLAT_SHIFT	12
+#define NFSLAT		20
+
+struct FsLatency {
+	uint32_t fl_count;
+	uint32_t fl_max;		// slowest request
+	uint64_t fl_total;		// all requests together
+	uint32_t fl_hist[NFSLAT];
+};
+
+struct Fsreq_stats {
+	int req_reset;			// start counting over after the reply
+	struct FsLatency ret_lat[NFSREQ];	// indexed by request code
+};
+
 #endif /* !JOS_INC_FS_H */
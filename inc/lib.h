@@ -53,10 +53,26 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	sys_ipc_try_send_pages(envid_t to_env, uint32_t value, uintptr_t *pgs, int npages, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_recv_pages(void *rcv_pg, int npages);
+int	sys_ipc_recv_nb(void *rcv_pg);
+int	sys_ipc_recv_pages_nb(void *rcv_pg, int npages);
+int	sys_ipc_wait(void);
+int	sys_ipc_wait_until(uint32_t msec, bool nic);
 unsigned sys_time_msec();
 int	sys_nic_send(char *packet, int size);
+int	sys_nic_send_sg(const struct nic_seg *segs, int nseg, struct nic_txstat *st);
+int	sys_nic_send_batch(const struct nic_frame *frames, int nframes, struct nic_txstat *st);
+int	sys_nic_stats(struct nic_stats *st);
 int	sys_nic_recv(char *data, int *size);
+int	sys_nic_recv_wait(char *data, int *size);
+int	sys_nic_recv_page(void *va);
+int	sys_nic_recv_pages(void *va, int n);
+int	sys_nic_recv_pages_nb(void *va, int n);
+int	sys_nic_ring_map(void *va);
+int	sys_nic_ring_sync(void);
+int	sys_nic_wait(void);
 void	sys_reboot(void);
 
 // This must be inlined.  Exercise for reader: why?
@@ -76,6 +92,8 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int	ipc_send_pages(envid_t to_env, uint32_t value, uintptr_t *pgs, int npages, int perm);
+int32_t ipc_recv_pages(envid_t *from_env_store, void *pg, int npages, int *perm_store);
 
 // fork.c
 #define	PTE_SHARE	0x400
@@ -91,10 +109,12 @@ void	close_all(void);
 ssize_t	readn(int fd, void *buf, size_t nbytes);
 int	dup(int oldfd, int newfd);
 int	fstat(int fd, struct Stat *statbuf);
-int	stat(const char *path, struct Stat *statbuf);
 
 // file.c
 int	open(const char *path, int mode);
+int	stat(const char *path, struct Stat *statbuf);
+int	readdir(int fd, struct Dirent *d, int n);
+int	preallocate(int fd, off_t size);
 int	read_map(int fd, off_t offset, void **blk);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
@@ -103,11 +123,16 @@ int	sync(void);
 // fsipc.c
 int	fsipc_open(const char *path, int omode, struct Fd *fd);
 int	fsipc_map(int fileid, off_t offset, void *dst_va);
+int	fsipc_map_range(int fileid, off_t offset, int npages, void *dst_va);
 int	fsipc_set_size(int fileid, off_t size);
+int	fsipc_prealloc(int fileid, off_t size);
 int	fsipc_close(int fileid);
 int	fsipc_dirty(int fileid, off_t offset);
 int	fsipc_remove(const char *path);
 int	fsipc_sync(void);
+int	fsipc_stat(const char *path, struct Stat *st);
+int	fsipc_readdir(int fileid, off_t *offset, struct Dirent *d, int n);
+int	fsipc_stats(struct FsLatency *lat, bool reset);
 
 // sockets.c
 int     accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -119,6 +144,16 @@ int     listen(int s, int backlog);
 int     recv(int s, void *mem, int len, unsigned int flags);
 int     send(int s, const void *dataptr, int size, unsigned int flags);
 int     socket(int domain, int type, int protocol);
+int     sendfile(int s, int fd, off_t offset, size_t len);
+int     sockring(int s);
+int     poll(struct pollfd *fds, int nfds, int timeout);
+int     select(int maxfdp1, fd_set *readset, fd_set *writeset,
+	       fd_set *exceptset, struct timeval *timeout);
+int     epoll_create(int size);
+int     epoll_ctl(int ep, int op, int s, struct epoll_event *event);
+int     epoll_wait(int ep, struct epoll_event *events, int maxevents,
+		   int timeout);
+int     epoll_close(int ep);
 
 // nsipc.c
 int     nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -130,6 +165,16 @@ int     nsipc_listen(int s, int backlog);
 int     nsipc_recv(int s, void *mem, int len, unsigned int flags);
 int     nsipc_send(int s, const void *dataptr, int size, unsigned int flags);
 int     nsipc_socket(int domain, int type, int protocol);
+int     nsipc_sendfile(int s, int fd, off_t offset, int size);
+int     nsipc_ring(int s, struct Nsring *ring);
+int     nsipc_ringwait(int s, uint32_t events);
+void    nsipc_ringkick(void);
+int     nsipc_poll(struct pollfd *fds, int nfds, int timeout);
+int     nsipc_epoll_create(void);
+int     nsipc_epoll_ctl(int ep, int op, int s, struct epoll_event *event);
+int     nsipc_epoll_wait(int ep, struct epoll_event *events, int maxevents,
+			 int timeout);
+int     nsipc_epoll_close(int ep);
 
 // pageref.c
 int pageref(void *addr);
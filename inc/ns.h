@@ -23,6 +23,21 @@
 
 #define NSREQ_TIMER	12
 
+#define NSREQ_SENDFILE	13
+
+#define NSREQ_RING	14
+#define NSREQ_RINGWAIT	15
+#define NSREQ_RINGKICK	16
+
+#define NSREQ_POLL		17
+#define NSREQ_EPOLL_CREATE	18
+#define NSREQ_EPOLL_CTL		19
+#define NSREQ_EPOLL_WAIT	20
+#define NSREQ_EPOLL_CLOSE	21
+
+// Most data pages a single NSREQ_SENDFILE request can carry
+#define NSMAXSENDPAGES	32
+
 struct Nsreq_accept {
     int req_s;
 };
@@ -58,25 +73,155 @@ struct Nsreq_listen {
     int req_backlog;
 };
 
+// With req_npages 0 the data comes back in the reply page, a page at
+// most.  Otherwise the caller lends the pages of its buffer after the
+// request page, and the data goes straight into them.
 struct Nsreq_recv {
     int req_s;
     int req_len;
     unsigned int req_flags;
+    int req_offset;	// where the buffer starts in the first page
+    int req_npages;
 };
 
+// With req_npages 0 the data follows in the request page, NSMAXINLINE
+// bytes at most.  Otherwise the caller lends the pages it is in, after
+// the request page, as for NSREQ_RECV.
 struct Nsreq_send {
     int req_s;
     int req_size;
     unsigned int req_flags;
+    int req_offset;
+    int req_npages;
     char req_dataptr[0];
 };
 
+#define NSMAXINLINE	(PGSIZE - sizeof(struct Nsreq_send))
+
+// The data pages follow the request page in the same IPC.
+struct Nsreq_sendfile {
+    int req_s;
+    int req_offset;	// where the data starts in the first page
+    int req_size;
+    int req_npages;
+};
+
+// The frames follow the request page in the same IPC, a page each, with
+// a struct jif_pkt NIC_PKTOFF bytes in.
+struct Nsreq_input {
+    int req_npkts;
+};
+
 struct Nsreq_socket {
     int req_domain;
     int req_type;
     int req_protocol;
 };
 
+// A TCP socket's rings, shared between the app and ns once the app asks
+// with sockring(): the header page, then NSRING_PAGES pages of received
+// data, then as many of data to send.  Each index only grows; the
+// producer owns one, the consumer the other.  ns fills the receive ring
+// from lwIP as data comes in and sends what the app puts in the send
+// ring, so recv and send need an IPC only to wait or to wake ns up.
+#define NSRING_PAGES	8
+#define NSRING_SIZE	(NSRING_PAGES * PGSIZE)
+#define NSRING_NPAGES	(1 + 2 * NSRING_PAGES)
+#define NSMAXRINGS	32	// sockets numbered below this may have one
+
+struct Nsring {
+    volatile uint32_t sr_rxprod;	// ns
+    volatile uint32_t sr_rxcons;	// app
+    volatile uint32_t sr_txprod;	// app
+    volatile uint32_t sr_txcons;	// ns
+    volatile uint32_t sr_events;	// bumped by ns after changing anything
+    volatile uint32_t sr_rxfull;	// ns stopped for room: kick it
+    volatile uint32_t sr_txidle;	// ns waits for data: kick it
+    volatile int sr_rxeof;	// no more data will come in
+    volatile int sr_txerr;	// sending failed; nothing more goes out
+};
+
+#define NSRING_RXDATA(r)	((char *) (r) + PGSIZE)
+#define NSRING_TXDATA(r)	((char *) (r) + (1 + NSRING_PAGES) * PGSIZE)
+
+// The ring pages follow the request page in the same IPC.
+struct Nsreq_ring {
+    int req_s;
+};
+
+// Replies once the ring's sr_events is no longer req_events.
+struct Nsreq_ringwait {
+    int req_s;
+    uint32_t req_events;
+};
+
+// Readiness, for poll and epoll.  lwIP has no more than NSMAXSOCKETS
+// sockets, so that is all a poll or an interest set can hold.
+#define POLLIN		0x001
+#define POLLOUT		0x004
+#define POLLERR		0x008	// reported whether asked for or not
+#define POLLHUP		0x010	// likewise
+#define POLLNVAL	0x020	// likewise: no such socket
+
+#define NSMAXSOCKETS	32	// lwIP's MEMP_NUM_NETCONN
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+// The reply page is the request page, with revents filled in.
+struct Nsreq_poll {
+    int req_nfds;
+    int req_timeout;	// msec; < 0 to wait for as long as it takes
+    struct pollfd req_fds[NSMAXSOCKETS];
+};
+
+#define EPOLLIN		POLLIN
+#define EPOLLOUT	POLLOUT
+#define EPOLLERR	POLLERR
+#define EPOLLHUP	POLLHUP
+
+#define EPOLL_CTL_ADD	1
+#define EPOLL_CTL_DEL	2
+#define EPOLL_CTL_MOD	3
+
+typedef union epoll_data {
+    void *ptr;
+    int fd;
+    uint32_t u32;
+} epoll_data_t;
+
+struct epoll_event {
+    uint32_t events;
+    epoll_data_t data;
+};
+
+// An interest set lives in ns, so waiting on it carries no socket list;
+// every ready socket comes back at once in the reply page, up to
+// NSMAXEVENTS of them.
+#define NSMAXEPOLL	16	// interest sets ns keeps
+#define NSMAXEVENTS	(PGSIZE / sizeof(struct epoll_event))
+
+struct Nsreq_epoll_ctl {
+    int req_ep;
+    int req_op;
+    int req_s;
+    struct epoll_event req_event;
+};
+
+// The reply page is the request page, holding the events.
+struct Nsreq_epoll_wait {
+    int req_ep;
+    int req_maxevents;
+    int req_timeout;	// as for NSREQ_POLL
+};
+
+struct Nsreq_epoll_close {
+    int req_ep;
+};
+
 struct jif_pkt {
     int jp_len;
     char jp_data[0];
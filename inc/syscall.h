@@ -1,6 +1,8 @@
 #ifndef JOS_INC_SYSCALL_H
 #define JOS_INC_SYSCALL_H
 
+#include <inc/types.h>
+
 /* system call numbers */
 enum
 {
@@ -22,7 +24,94 @@ enum
 	SYS_time_msec,
 	SYS_nic_send,
 	SYS_nic_recv,
+	SYS_ipc_try_send_pages,
+	SYS_ipc_wait,
+	SYS_nic_recv_page,
+	SYS_nic_send_sg,
+	SYS_nic_stats,
+	SYS_nic_send_batch,
+	SYS_nic_recv_pages,
+	SYS_nic_ring_map,
+	SYS_nic_ring_sync,
+	SYS_nic_wait,
 	NSYSCALLS,
 };
 
+// A page handed over by SYS_nic_recv_page holds the received frame as
+// a struct jif_pkt (inc/ns.h) this many bytes into the page.
+#define NIC_PKTOFF	12
+
+// A piece of a frame for SYS_nic_send_sg, which the NIC fetches straight
+// out of the sender's memory.
+struct nic_seg {
+	const void *ns_va;
+	uint32_t ns_len;
+};
+
+#define NIC_MAXSEGS	16	// pieces per frame
+
+// A frame for SYS_nic_send_batch, which takes a page full of them.
+struct nic_frame {
+	uint32_t nf_nseg;
+	struct nic_seg nf_seg[NIC_MAXSEGS];
+};
+
+#define NIC_MAXBATCH	(PGSIZE / sizeof(struct nic_frame))
+
+// Transmit progress as SYS_nic_send_sg reports it.  The memory of a frame
+// sent with it must be left alone until tx_done catches up with the
+// tx_queued reported when it was sent.
+struct nic_txstat {
+	uint32_t tx_queued;	// frames queued so far
+	uint32_t tx_done;	// frames the NIC is done with
+};
+
+// NIC counters, as SYS_nic_stats reports them.
+struct nic_stats {
+	uint32_t tx_queued;
+	uint32_t tx_done;
+	uint32_t tx_drops;	// frames dropped for want of a TCB
+	uint32_t rx_frames;
+	uint32_t rx_overruns;	// times the NIC ran out of RFDs
+};
+
+// The NIC rings as SYS_nic_ring_map maps them: this control page, then
+// the transmit buffers, then the receive slots, a page each.  The env
+// copies frames into transmit buffers, sets their lengths and bumps
+// nr_txprod; the buffers are its again once nr_txcons gets past them.
+// It reads received frames straight out of the receive slots and bumps
+// nr_rxcons once done with them.  SYS_nic_ring_sync hands both counts to
+// the NIC.  Slots are used round in order, the counts run free.
+#define NIC_RING_MAXTX	512
+#define NIC_RING_MAXRX	512
+#define NIC_RING_BUFSZ	2048
+#define NIC_RING_SIZE	((1 + NIC_RING_MAXTX / 2 + NIC_RING_MAXRX) * PGSIZE)
+
+struct nic_ring {
+	uint32_t nr_ntx;		// transmit slots
+	uint32_t nr_nrx;		// receive slots
+	uint32_t nr_rxfirst;		// receive slot the NIC fills first
+	char *nr_txbuf;			// slot i at nr_txbuf + i * NIC_RING_BUFSZ
+	char *nr_rxbuf;			// slot i at nr_rxbuf + i * PGSIZE
+	volatile uint32_t nr_txprod;	// frames the env filled in
+	volatile uint32_t nr_txcons;	// frames the NIC is done with
+	volatile uint32_t nr_rxcons;	// frames the env is done with
+	uint16_t nr_txlen[NIC_RING_MAXTX];
+};
+
+// A receive slot is the NIC's descriptor itself: the frame is in once
+// bit 15 is set in the 16-bit words at 0 and at NIC_PKTOFF, the low 14
+// bits of the latter giving its length.  Returns -1 if it is not in yet.
+static __inline int
+nic_ring_rxlen(const void *slot)
+{
+	const volatile uint16_t *w = slot;
+
+	if (!(w[0] & 0x8000) || !(w[NIC_PKTOFF / 2] & 0x8000))
+		return -1;
+	return w[NIC_PKTOFF / 2] & 0x3fff;
+}
+
+#define NIC_RING_RXDATA(slot)	((char *)(slot) + NIC_PKTOFF + 4)
+
 #endif /* !JOS_INC_SYSCALL_H */
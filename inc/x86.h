@@ -35,6 +35,7 @@ static __inline uint32_t read_esp(void) __attribute__((always_inline));
 static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
 static __inline uint32_t xchg(volatile uint32_t *addr, uint32_t newval) __attribute__((always_inline));
+static __inline uint32_t bsf(uint32_t x) __attribute__((always_inline));
 
 static __inline void
 breakpoint(void)
@@ -288,6 +289,15 @@ xchg(volatile uint32_t *addr, uint32_t newval)
   return result;
 }
 
+// Index of the lowest set bit of x; x must not be 0.
+static __inline uint32_t
+bsf(uint32_t x)
+{
+	uint32_t r;
+	__asm __volatile("bsfl %1, %0" : "=r" (r) : "rm" (x) : "cc");
+	return r;
+}
+
 static __inline void
 nop_pause(void)
 {
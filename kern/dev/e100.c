@@ -9,9 +9,12 @@
  */
 #include <inc/x86.h>
 #include <inc/string.h>
+#include <inc/error.h>
+#include <inc/syscall.h>
 #include <kern/pmap.h>
 #include <kern/picirq.h>
 #include <kern/mp.h>
+#include <kern/env.h>
 
 #include "e100.h"
 
@@ -49,6 +52,8 @@ enum scb_offsets {
  * MORE INFO SEE P.43
  */
 enum scb_status {
+	scb_status_cus_mask = 3 << 6,	/* The state of the CU */
+	scb_status_cus_suspended = 1 << 6,
 	scb_status_rus_suspended = 1 << 2,
 	scb_status_rnr = 1 << 12, /* The RU is not ready */
 	scb_status_cna = 1 << 13, /* CU leaves Active state */
@@ -63,7 +68,9 @@ enum scb_command {
 	scb_ru_resume	= 2,
 	scb_ruc_ldbase	= 6,
 	scb_cu_start	= 1 << 4,  /* Star CU execution */
+	scb_cu_resume	= 2 << 4,  /* Go on from where the CU suspended */
 	scb_cuc_ldbase	= 6 << 4, /* Load the base address for CU */
+	scb_mask_fr	= 1 << 14, /* Mask the FR interrupt */
 };
 
 enum port_command {
@@ -87,7 +94,7 @@ struct E100 e100;
  *  +--------------+--------------+
  *  |TBD COUNT|THRS|TCB BYTE COUNT|
  *  +--------------+--------------+
- *  |            DATA             |
+ *  |          TBD ARRAY          |
  *  +--------------+--------------+
  **********************************
  *  MORE INFO SEE P.113
@@ -96,33 +103,43 @@ struct Tcb {
 	volatile uint16_t status;
 	uint16_t command; 	/* Action commands*/
 	uint32_t link;		/* Links to the next TCB in physical addr */
-	uint32_t tbdaddr; 	/* Not used in simplified mode */
-	uint16_t size;
+	uint32_t tbdaddr; 	/* Our own tbd[] */
+	uint16_t size;		/* Nothing in the TCB itself: always 0 */
 	uint8_t threshold;	/* Spesify how much data in adapter's FIFO*/
-	uint8_t tbdcount;	/* Not used */
-	uint8_t data[E100_MAX_PKT_SIZE]; /* Stores Packet to be sent */
+	uint8_t tbdcount;
+	struct Tbd tbd[E100_MAX_TBD];
 };
 
+#define TCBS_PER_PAGE	(PGSIZE / sizeof(struct Tcb))
+
 /* Action comands in TCB */
 enum tcb_command {
 	tcb_tx	= 4,		/* Transmit */
+	tcb_sf	= 1 << 3,	/* Flexible mode: the frame is in the TBDs */
 	tcb_s	= 1 << 14,	/* Suspended */
 };
 
+enum tcb_status {
+	tcb_status_c	= 1 << 15,	/* The adapter is done with it */
+};
+
 /* Helper macros to manipulate our CBL */
 
 #define CBL_IS_EMPTY() (e100.cbl_count == 0)
 #define CBL_IS_FULL() (e100.cbl_count == CBL_SIZE)
 /* CBL_NEXT() returns where the data to be sent is loaded in CBL */
 #define CBL_NEXT() ((e100.cbl_head + e100.cbl_count) % CBL_SIZE)
-/* CBL_HEAD returns where in CBL the CU choose to send when starting */
+/* CBL_HEAD returns the oldest TCB the adapter may not be done with */
 #define CBL_HEAD() (e100.cbl_head)
 
-/* Make up a DMA ring for CBL.Transmitting with tcb_s, after every
- * sending completes, the adapter will interrupt us so we can
- * do some accounting and then restart it at CBL_HEAD().
+/* Make up a DMA ring for CBL.  Frames always go in flexible mode, the
+ * adapter fetching them by the TBD array from wherever they are, so a
+ * TCB is small and TCBS_PER_PAGE of them share a page.
  *
- * Simplified mode.
+ * Only the TCB queued last carries tcb_s: the CU runs through all the
+ * frames queued before it suspends, and one doorbell (e100_kickcu)
+ * covers a whole batch.  When the CU suspends the adapter interrupts
+ * us so we can retire the TCBs it is done with.
  *
  * +-----------------------------+
  * |                             |
@@ -138,14 +155,15 @@ cbl_init()
 
 	e100.cbl_count = 0;
 	e100.cbl_head = 0;
+	e100.cu_started = 0;
 	for (i = 0; i < CBL_SIZE; i++) {
-		if ((r = page_alloc(&p)) < 0)
+		if (i % TCBS_PER_PAGE == 0 && (r = page_alloc(&p)) < 0)
 			panic("e100_init");
 
-		e100.cbl[i] = (struct Tcb *)page2kva(p);
+		e100.cbl[i] = (struct Tcb *)page2kva(p) + i % TCBS_PER_PAGE;
 		e100.cbl[i]->status = 0;
-		e100.cbl[i]->command = tcb_tx | tcb_s;
-		e100.cbl[i]->tbdaddr = 0xffffffff;
+		e100.cbl[i]->command = tcb_tx | tcb_sf | tcb_s;
+		e100.cbl[i]->tbdaddr = PADDR(e100.cbl[i]->tbd);
 		e100.cbl[i]->size = 0;
 		e100.cbl[i]->threshold = 0xE0; /* Maximum bytes to be present in
 						* the adapter's FIFO*/
@@ -165,18 +183,91 @@ cbl_init()
 	outw(e100.iobase + scb_cmd, scb_cuc_ldbase);
 }
 
+/* The adapter clears the command byte once it has taken a command */
 static void
-e100_startcu(void)
+e100_scb_wait(void)
+{
+	int i;
+
+	for (i = 0; i < 10000; i++)
+		if (inb(e100.iobase + scb_cmd) == 0)
+			return;
+}
+
+/* Ring the doorbell: have the CU go on to the TCBs queued since it
+ * suspended.  The CU may already have gone past the old tail when
+ * its tcb_s was cleared; then it is still active and there is no need.
+ */
+static void
+e100_kickcu(void)
 {
 	if (CBL_IS_EMPTY())
 		return;	/* Silently return if no packets to send */
 
-	outl(e100.iobase + scb_pointer, PADDR(e100.cbl[CBL_HEAD()]));
-	outw(e100.iobase + scb_cmd, scb_cu_start);
+	e100_scb_wait();
+	if (!e100.cu_started) {
+		outl(e100.iobase + scb_pointer, PADDR(e100.cbl[CBL_HEAD()]));
+		outw(e100.iobase + scb_cmd, scb_cu_start);
+		e100.cu_started = 1;
+	} else if ((inw(e100.iobase + scb_status) & scb_status_cus_mask) ==
+		   scb_status_cus_suspended)
+		outw(e100.iobase + scb_cmd, scb_cu_resume);
+}
+
+/* Retire the TCBs the adapter is done with, letting go of the pages
+ * they sent from.
+ */
+static void
+cbl_reclaim(void)
+{
+	int i;
+	struct Tcb *tcb;
+
+	while (!CBL_IS_EMPTY()) {
+		tcb = e100.cbl[CBL_HEAD()];
+		if (!(tcb->status & tcb_status_c))
+			break;
+		for (i = 0; i < tcb->tbdcount; i++)
+			page_decref(pa2page(tcb->tbd[i].addr));
+		e100.cbl_head = (e100.cbl_head + 1) % CBL_SIZE;
+		e100.cbl_count--;
+		e100.tx_done++;
+	}
+	if (e100.ring_owner && (int32_t)(e100.tx_done - e100.ring_txbase) > 0)
+		e100.ring->nr_txcons = e100.tx_done - e100.ring_txbase;
+}
+
+/* Take the next TCB to fill in, or NULL if the CBL is full. */
+static struct Tcb *
+cbl_get(void)
+{
+	struct Tcb *tcb;
+
+	cbl_reclaim();
+	if (CBL_IS_FULL()) {
+		e100.tx_drops++;
+		return NULL;
+	}
+	tcb = e100.cbl[CBL_NEXT()];
+	tcb->status = 0;
+	tcb->command = tcb_tx | tcb_sf | tcb_s;
+	return tcb;
+}
+
+/* Queue the TCB cbl_get returned, once its TBDs are filled in.  It is
+ * up to the caller to kick the CU.
+ */
+static void
+cbl_put(struct Tcb *tcb)
+{
+	/* Let the CU run on from the old tail */
+	e100.cbl[(CBL_NEXT() - 1 + CBL_SIZE) % CBL_SIZE]->command &= ~tcb_s;
+	e100.cbl_count++;
+	e100.tx_queued++;
 }
 
 /* This function implement main part of sending a packet, adding packet into
- * transimit block list.
+ * transimit block list.  The packet is copied to a page of its own.
  *
  * p: points to the packet to be sent
  * sz: size of the packet
@@ -186,23 +277,97 @@ e100_startcu(void)
 int
 e100_add_tcb(char *p, int sz)
 {
-	int is;
-	int n;
-	if (CBL_IS_FULL())
+	struct Tcb *tcb;
+	struct Page *pp;
+
+	spin_lock(&e100.lock);
+	if (!(tcb = cbl_get()) || page_alloc(&pp) < 0) {
+		spin_unlock(&e100.lock);
 		return -1;	/* Simply drop the packet */
+	}
 
-	is = CBL_IS_EMPTY();	/* If the cbl is empty, the adapter should be in idle/suspended state */
-	n = CBL_NEXT();
-	e100.cbl[n]->status = 0;
-	memmove(e100.cbl[n]->data, p, sz);
-	e100.cbl[n]->size = sz;
-	e100.cbl_count++;
+	atomic_inc(&pp->pp_ref);	/* cbl_reclaim frees it */
+	memmove(page2kva(pp), p, sz);
+	tcb->tbd[0].addr = page2pa(pp);
+	tcb->tbd[0].size = sz;
+	tcb->tbd[0].el = 0;
+	tcb->tbdcount = 1;
+	cbl_put(tcb);
+
+	e100_kickcu();
+	spin_unlock(&e100.lock);
+	return 0;
+}
+
+/* Queue frames the adapter fetches from the pieces their TBDs point to,
+ * holding the pages until it is done with them:
+ *
+ *	e100_tx_begin();
+ *	e100_tx_add(tbd, n);	... as many as there are
+ *	e100_tx_end(st);
+ *
+ * The CU gets kicked once, at e100_tx_end, for the lot.
+ */
+void
+e100_tx_begin(void)
+{
+	spin_lock(&e100.lock);
+}
 
-	if (is)
-		e100_startcu();
+/* Returns -1 when it drops the packet
+ * Returns 0 on success
+ */
+int
+e100_tx_add(struct Tbd *tbd, int n)
+{
+	int i;
+	struct Tcb *tcb;
+
+	assert(n > 0 && n <= E100_MAX_TBD);
+	if (!(tcb = cbl_get()))
+		return -1;
+	for (i = 0; i < n; i++) {
+		tcb->tbd[i] = tbd[i];
+		atomic_inc(&pa2page(tbd[i].addr)->pp_ref);
+	}
+	tcb->tbdcount = n;
+	cbl_put(tcb);
 	return 0;
 }
 
+/* Reports the transmit progress in *st, counting the frames just queued */
+void
+e100_tx_end(struct nic_txstat *st)
+{
+	e100_kickcu();
+	st->tx_queued = e100.tx_queued;
+	st->tx_done = e100.tx_done;
+	spin_unlock(&e100.lock);
+}
+
+void
+e100_txstat(struct nic_txstat *st)
+{
+	spin_lock(&e100.lock);
+	cbl_reclaim();
+	st->tx_queued = e100.tx_queued;
+	st->tx_done = e100.tx_done;
+	spin_unlock(&e100.lock);
+}
+
+void
+e100_stats(struct nic_stats *st)
+{
+	spin_lock(&e100.lock);
+	cbl_reclaim();
+	st->tx_queued = e100.tx_queued;
+	st->tx_done = e100.tx_done;
+	st->tx_drops = e100.tx_drops;
+	st->rx_frames = e100.rx_frames;
+	st->rx_overruns = e100.rx_overruns;
+	spin_unlock(&e100.lock);
+}
+
 /**********************************************************************
  *                      Recieve Frame Area			      *
  **********************************************************************/
@@ -311,30 +476,333 @@ rfa_makeroom(void)
  * Returns 0 on success
  * Returns -1 if fails
  */
+#define RFA_READY(n) ((e100.rfa[n]->status & rfd_status_c) &&		\
+		      (e100.rfa[n]->status2 & rfd_status2_eof))
+
 int
 e100_rem_rfd(char *p, int *sz)
 {
 	int n;
+
+	spin_lock(&e100.lock);
 	n = RFA_NEXT();
 
-	if ((e100.rfa[n]->status & rfd_status_c) &&
-	    (e100.rfa[n]->status2 & rfd_status2_eof)) {
+	if (RFA_READY(n)) {
 		*sz = e100.rfa[n]->status2 & rfd_status2_count_mask;
 		memmove(p, e100.rfa[n]->data, *sz);
 		RFA_INIT(n, 0); /* Mark it as free */
 		RFA_INC();
+		e100.rx_frames++;
 
 		/* Now we can make room for RFA */
 		if (e100.rfa_noroom)
 			rfa_makeroom();
+		spin_unlock(&e100.lock);
 		return 0;	/* Successfully get an packet */
 	}
 
-	p = NULL;
-	sz = 0;
+	spin_unlock(&e100.lock);
 	return -1;   /* If fails simply returning without a packet */
 }
 
+/* Like e100_rem_rfd, but instead of copying the frame out, take the page
+ * of its RFD out of the RFA whole and put a fresh page in its place.  The
+ * frame length is stored over the finished RFD header, so the page holds
+ * a struct jif_pkt at NIC_PKTOFF.
+ *
+ * Returns the length of the frame, in *pp the page
+ * Returns -1 if there is no frame
+ * Returns -E_NO_MEM if no page is left to replenish the RFA
+ */
+int
+e100_rem_rfd_page(struct Page **pp)
+{
+	int n, sz, r;
+	struct Page *np;
+	struct Rfd *old, *new;
+
+	static_assert(offsetof(struct Rfd, data) == NIC_PKTOFF + sizeof(int));
+
+	spin_lock(&e100.lock);
+	n = RFA_NEXT();
+	if (!RFA_READY(n)) {
+		spin_unlock(&e100.lock);
+		return -1;
+	}
+	if ((r = page_alloc(&np)) < 0) {
+		spin_unlock(&e100.lock);
+		return r;
+	}
+
+	/* The adapter is done with RFD n, and reads the link of the one
+	 * before it only once it has filled that one, so relinking is safe */
+	old = e100.rfa[n];
+	new = (struct Rfd *)page2kva(np);
+	new->link = old->link;
+	e100.rfa[(n - 1 + RFA_SIZE) % RFA_SIZE]->link = PADDR(new);
+	e100.rfa[n] = new;
+	RFA_INIT(n, 0);
+	RFA_INC();
+	e100.rx_frames++;
+
+	sz = old->status2 & rfd_status2_count_mask;
+	((int *)old->data)[-1] = sz;	/* jif_pkt.jp_len */
+	if (e100.rfa_noroom)
+		rfa_makeroom();
+	spin_unlock(&e100.lock);
+
+	*pp = pa2page(PADDR(old));
+	return sz;
+}
+
+/* Receiving goes NAPI-style.  While frames keep coming the receiver polls
+ * the RFA and the FR interrupt stays masked, so a busy link costs no
+ * interrupts.  Only once the RFA runs dry does the receiver go to sleep
+ * with the interrupt unmasked; the next frame wakes it up and masks the
+ * interrupt again.
+ */
+static void
+e100_rx_intr(int on)
+{
+	outb(e100.iobase + scb_cmd + 1, on ? 0 : scb_mask_fr >> 8);
+}
+
+/* Let the env 'envid', which must already be marked not runnable, sleep
+ * until a frame comes in.
+ *
+ * Returns 0 if it is to sleep
+ * Returns -1 if a frame is already waiting in the RFA
+ */
+int
+e100_rx_sleep(envid_t envid)
+{
+	spin_lock(&e100.lock);
+	/* Unmask first: a frame that comes in after the check below is
+	 * then sure to interrupt */
+	e100_rx_intr(1);
+	if (RFA_READY(RFA_NEXT())) {
+		e100_rx_intr(0);
+		spin_unlock(&e100.lock);
+		return -1;
+	}
+	e100.rx_waiter = envid;
+	spin_unlock(&e100.lock);
+	return 0;
+}
+
+static void
+e100_rx_wakeup(void)
+{
+	struct Env *e;
+
+	e100_rx_intr(0);	/* Back to polling */
+	if (!e100.rx_waiter)
+		return;
+	e = &envs[ENVX(e100.rx_waiter)];
+	spin_lock(&e->env_lock);
+	if (e->env_id == e100.rx_waiter && e->env_status == ENV_NOT_RUNNABLE)
+		e->env_status = ENV_RUNNABLE;
+	spin_unlock(&e->env_lock);
+	e100.rx_waiter = 0;
+}
+
+/**********************************************************************
+ *                      Mapped rings				      *
+ **********************************************************************/
+/* An env may map the rings into itself and drive the NIC from there
+ * (SYS_nic_ring_map): it copies frames into transmit buffers of the
+ * ring's own and reads received ones straight out of the RFDs, which it
+ * gets read-only.  The descriptors stay ours, so the adapter is never
+ * pointed anywhere but at those pages; the env only traps to ring the
+ * doorbell (e100_ring_sync) and to sleep until a frame comes in.
+ *
+ * While the env is around the rings are all its own and the other NIC
+ * syscalls fail, until e100_ring_reclaim finds it gone.
+ */
+#define RING_TXPAGES	((CBL_SIZE + 1) / 2)
+
+static bool
+ring_live(void)
+{
+	struct Env *e = &envs[ENVX(e100.ring_owner)];
+
+	return e->env_id == e100.ring_owner && e->env_status != ENV_FREE;
+}
+
+static int
+ring_alloc(void)
+{
+	int i, r;
+	struct Page *pp;
+
+	for (i = 0; i < RING_TXPAGES; i++) {
+		if ((r = page_alloc(&pp)) < 0)
+			return r;
+		atomic_inc(&pp->pp_ref);	/* Ours for good */
+		e100.ring_txbuf[i] = pp;
+	}
+	if ((r = page_alloc(&pp)) < 0)
+		return r;
+	atomic_inc(&pp->pp_ref);
+	e100.ring = (struct nic_ring *)page2kva(pp);
+	return 0;
+}
+
+/* Map the rings into env e at va, handing them over from whoever had
+ * them; mapping them again starts them over.
+ *
+ * Returns 0 on success
+ * Returns -E_BAD_ENV if another env has them
+ */
+int
+e100_ring_map(struct Env *e, uintptr_t va)
+{
+	int i, r;
+	struct nic_ring *ring;
+	struct Page *rfd[RFA_SIZE];
+	uintptr_t txva, rxva;
+
+	static_assert(CBL_SIZE <= NIC_RING_MAXTX && RFA_SIZE <= NIC_RING_MAXRX);
+	static_assert(offsetof(struct Rfd, status2) == NIC_PKTOFF);
+
+	if (va % PGSIZE || va >= UTOP || UTOP - va < NIC_RING_SIZE)
+		return -E_INVAL;
+	txva = va + PGSIZE;
+	rxva = txva + RING_TXPAGES * PGSIZE;
+
+	spin_lock(&e100.lock);
+	if (e100.ring_owner && e100.ring_owner != e->env_id && ring_live()) {
+		spin_unlock(&e100.lock);
+		return -E_BAD_ENV;
+	}
+	if (!e100.ring && (r = ring_alloc()) < 0) {
+		spin_unlock(&e100.lock);
+		return r;
+	}
+	/* The RFDs must outlive the env's mappings of them */
+	if (!e100.ring_owner)
+		for (i = 0; i < RFA_SIZE; i++)
+			atomic_inc(&pa2page(PADDR(e100.rfa[i]))->pp_ref);
+	for (i = 0; i < RFA_SIZE; i++)
+		rfd[i] = pa2page(PADDR(e100.rfa[i]));
+
+	e100.ring_owner = e->env_id;
+	e100.ring_txslot = 0;
+	e100.ring_txposted = 0;
+	e100.ring_txbase = e100.tx_queued;
+	e100.ring_rxcons = 0;
+	ring = e100.ring;
+	ring->nr_ntx = CBL_SIZE;
+	ring->nr_nrx = RFA_SIZE;
+	ring->nr_rxfirst = RFA_NEXT();
+	ring->nr_txbuf = (char *)txva;
+	ring->nr_rxbuf = (char *)rxva;
+	ring->nr_txprod = 0;
+	ring->nr_txcons = 0;
+	ring->nr_rxcons = 0;
+	spin_unlock(&e100.lock);
+
+	/* Mapping may shoot down TLBs, so not under the lock */
+	if ((r = page_insert(e->env_pgdir, pa2page(PADDR(ring)), (void *)va,
+			     PTE_U|PTE_P|PTE_W)) < 0)
+		return r;
+	for (i = 0; i < RING_TXPAGES; i++)
+		if ((r = page_insert(e->env_pgdir, e100.ring_txbuf[i],
+				     (void *)(txva + i * PGSIZE),
+				     PTE_U|PTE_P|PTE_W)) < 0)
+			return r;
+	for (i = 0; i < RFA_SIZE; i++)
+		if ((r = page_insert(e->env_pgdir, rfd[i],
+				     (void *)(rxva + i * PGSIZE),
+				     PTE_U|PTE_P)) < 0)
+			return r;
+	return 0;
+}
+
+/* The doorbell: queue the frames the env has filled in since the last
+ * time, give the NIC back the RFDs the env is done with, and bring
+ * nr_txcons up to date.  Frame lengths out of range are clamped, so
+ * every slot goes out and they all retire in order.
+ *
+ * Returns 0 on success
+ * Returns -E_BAD_ENV if the rings are not the env's
+ * Returns -E_INVAL if the env claims more frames than there are slots
+ */
+int
+e100_ring_sync(envid_t envid)
+{
+	struct nic_ring *ring = e100.ring;
+	struct Tbd tbd;
+	uint32_t n;
+	int slot;
+
+	spin_lock(&e100.lock);
+	if (e100.ring_owner != envid) {
+		spin_unlock(&e100.lock);
+		return -E_BAD_ENV;
+	}
+	n = ring->nr_txprod - e100.ring_txposted;
+	if (n > CBL_SIZE) {
+		spin_unlock(&e100.lock);
+		return -E_INVAL;
+	}
+
+	cbl_reclaim();
+	for (; n > 0 && !CBL_IS_FULL(); n--) {
+		slot = e100.ring_txslot;
+		tbd.addr = page2pa(e100.ring_txbuf[slot / 2]) +
+			(slot % 2) * NIC_RING_BUFSZ;
+		tbd.size = MIN(MAX(ring->nr_txlen[slot], 14), E100_MAX_PKT_SIZE);
+		tbd.el = 0;
+		e100_tx_add(&tbd, 1);
+		e100.ring_txslot = (slot + 1) % CBL_SIZE;
+		e100.ring_txposted++;
+	}
+	e100_kickcu();
+
+	while ((int32_t)(ring->nr_rxcons - e100.ring_rxcons) > 0 &&
+	       RFA_READY(RFA_NEXT())) {
+		RFA_INIT(RFA_NEXT(), 0);
+		RFA_INC();
+		e100.rx_frames++;
+		e100.ring_rxcons++;
+	}
+	if (e100.rfa_noroom)
+		rfa_makeroom();
+	spin_unlock(&e100.lock);
+	return 0;
+}
+
+/* Take the rings back for the other NIC syscalls, once the env they are
+ * mapped into is gone.
+ *
+ * Returns 0 if they are the kernel's
+ * Returns -E_BAD_ENV while the env is still around
+ */
+int
+e100_ring_reclaim(void)
+{
+	int i, r;
+
+	if (!e100.ring_owner)
+		return 0;
+
+	r = 0;
+	spin_lock(&e100.lock);
+	if (!e100.ring_owner)
+		goto out;
+	if (ring_live()) {
+		r = -E_BAD_ENV;
+		goto out;
+	}
+	for (i = 0; i < RFA_SIZE; i++)
+		atomic_dec(&pa2page(PADDR(e100.rfa[i]))->pp_ref);
+	e100.ring_owner = 0;
+out:
+	spin_unlock(&e100.lock);
+	return r;
+}
+
 /* ***************SCB status word****************
  * +--------+--------+--------+--------+--------+
  * |STAT/ACK|  CUS   |  RUS   |   0    |   0    |
@@ -365,26 +833,31 @@ void
 e100_intr()
 {
 	int s;
+
+	spin_lock(&e100.lock);
 	s = inw(e100.iobase + scb_status);
 	/* Acknowledge all of the current interrupt sources ASAP.
 	 * For 82557, the bits[9:8] are reserved
 	 */
 	//outw(e100.iobase + scb_status, s & 0xfc00);
 	if (s & scb_status_cna) {
-		e100.cbl_count--; /* The packet got sent, so decrement
-				   * the count of cbl
-				   */
-		if (!CBL_IS_EMPTY())
-			e100_startcu();
+		cbl_reclaim();	/* The packets got sent */
+		e100_kickcu();	/* In case it suspended on a stale tail */
 		e100_cli(scb_status_cna);
 	}
 
+	if (s & scb_status_rnr)
+		e100.rx_overruns++;	/* The RFA ran full */
 	if (s & scb_status_rnr || s & scb_status_rus_suspended){
 		rfa_makeroom();
 		e100_cli(scb_status_rnr);
 	}
 
+	if (s & scb_status_fr)
+		e100_rx_wakeup();
+
 	e100_cli(scb_status_cx | scb_status_fr);
+	spin_unlock(&e100.lock);
 	/* Have to clear the interrupt on the PIC too */
 	irq_eoi(e100.irq_line);
 }
@@ -409,8 +882,10 @@ e100_init(void)
 	wait5us();
 	wait5us();
 
+	spin_init(&e100.lock);
 	cbl_init();
 	rfa_init();
+	e100_rx_intr(0);	/* Nobody waits for frames yet */
 	
 	/* Enable the previously allocated IRQ line */
 	irq_setmask_8259A(irq_mask_8259A & ~(1 << e100.irq_line));
@@ -5,30 +5,75 @@
 #endif
 
 #include <inc/x86.h>
+#include <inc/spinlock.h>
+#include <inc/env.h>
+#include <inc/syscall.h>
 #include <dev/pci.h>
 
-#define CBL_SIZE	4
-#define RFA_SIZE	8
+/* Ring sizes; see E100_CBL and E100_RFA in conf/env.mk.  TCBs share
+ * pages, but each RFD has a page of its own, which SYS_nic_recv_page
+ * hands over whole. */
+#ifndef CBL_SIZE
+#define CBL_SIZE	256
+#endif
+#ifndef RFA_SIZE
+#define RFA_SIZE	128
+#endif
 
 #define E100_MAX_PKT_SIZE		1518
+#define E100_MAX_TBD	(2 * NIC_MAXSEGS)	/* Each segment may cross a page */
+
+/* Transmit Buffer Descriptor: a piece of a frame the adapter fetches
+ * straight from memory in flexible mode.  MORE INFO SEE P.117
+ */
+struct Tbd {
+	uint32_t addr;		/* Physical address of the piece */
+	uint16_t size;
+	uint16_t el;		/* End of the TBD list, not used */
+};
 
 struct E100 {
 	uint32_t membase;
 	uint32_t iobase;
 	uint8_t irq_line;
 	struct Tcb *cbl[CBL_SIZE];
-	uint8_t cbl_head;
-	uint8_t cbl_count;
+	uint16_t cbl_head;
+	uint16_t cbl_count;
+	uint8_t cu_started;
 	struct Rfd *rfa[RFA_SIZE];
-	uint8_t rfa_head;
-	uint8_t rfa_tail;
+	uint16_t rfa_head;
+	uint16_t rfa_tail;
 	uint8_t rfa_noroom;
+	uint32_t tx_queued;	/* Frames queued so far */
+	uint32_t tx_done;	/* Frames the adapter is done with */
+	uint32_t tx_drops;	/* Frames dropped for a full CBL */
+	uint32_t rx_frames;	/* Frames taken out of the RFA */
+	uint32_t rx_overruns;	/* Times the RFA ran full */
+	envid_t rx_waiter;	/* Env sleeping until a frame comes in */
+	envid_t ring_owner;	/* Env the rings are mapped into, if any */
+	struct nic_ring *ring;	/* Its control page */
+	struct Page *ring_txbuf[(CBL_SIZE + 1) / 2];	/* Two buffers a page */
+	uint16_t ring_txslot;	/* Next transmit slot to post */
+	uint32_t ring_txposted;	/* Frames posted from the ring */
+	uint32_t ring_txbase;	/* tx_queued as the ring got mapped */
+	uint32_t ring_rxcons;	/* Receive slots given back to the NIC */
+	struct Spinlock lock;
 };
 
 extern struct E100 e100;
 
 int e100_attach(struct pci_func *pcif);
 int e100_add_tcb(char *packet, int size);
+void e100_tx_begin(void);
+int e100_tx_add(struct Tbd *tbd, int n);
+void e100_tx_end(struct nic_txstat *st);
+void e100_txstat(struct nic_txstat *st);
+void e100_stats(struct nic_stats *st);
 int e100_rem_rfd(char *p, int *sz);
+int e100_rem_rfd_page(struct Page **pp);
+int e100_rx_sleep(envid_t envid);
+int e100_ring_map(struct Env *e, uintptr_t va);
+int e100_ring_sync(envid_t envid);
+int e100_ring_reclaim(void);
 void e100_intr(void);
 #endif	// !JOS_DEV_E100_H
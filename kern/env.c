@@ -151,6 +151,7 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
+	e->env_wakeup = ~0;
 
 	// If this is the file server (e == &envs[1]) give it I/O privileges.
 	if (e == &envs[1])
@@ -325,6 +326,7 @@ env_run(struct Env *e)
 	//static int c = -1;
 	curenv = e;
 	e->env_runs++;
+	e->env_wakeup = ~0;	/* Whatever woke it, the sleep is over */
 	lcr3(e->env_cr3);
 	e->env_status = ENV_RUNNING;
 	spin_unlock(&e->env_lock); /* It's the caller's job to acquire the lock */
@@ -6,6 +6,7 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/time.h>
 
 /* Implement simple round-robin scheduling. */
 void
@@ -19,6 +20,10 @@ sched_yield(void)
 	for (i = 1; i < NENV; i++) {
 		pre = (pre + 1) % NENV ? (pre + 1) % NENV : 1;
 		spin_lock(&envs[pre].env_lock);
+		/* Wake up an env whose sleep has timed out */
+		if (envs[pre].env_status == ENV_NOT_RUNNABLE &&
+		    time_msec() >= envs[pre].env_wakeup)
+			envs[pre].env_status = ENV_RUNNABLE;
 		if (envs[pre].env_status == ENV_RUNNABLE) {
 			spin_unlock(&env_table_lock);
 			env_run(&envs[pre]);
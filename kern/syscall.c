@@ -258,6 +258,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 	target->env_ipc_from = curenv->env_id;
 	target->env_ipc_value = value;
 	target->env_ipc_perm = 0;
+	target->env_ipc_npages = 0;
 
 	if (srcva) {
 		if ((uintptr_t)srcva >= UTOP || (uintptr_t)srcva % PGSIZE) {
@@ -282,41 +283,145 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 				return r;
 			}
 			target->env_ipc_perm = perm;
-			target->env_status = ENV_RUNNABLE; /* Wake up the blocking recver */
+			target->env_ipc_npages = 1;
+			if (target->env_status == ENV_NOT_RUNNABLE)
+				target->env_status = ENV_RUNNABLE; /* Wake up the blocking recver */
 			spin_unlock(&target->env_lock);
 			return 1;
 		}
 	}
 
-	target->env_status = ENV_RUNNABLE; /* Wake up the blocking recver */
+	if (target->env_status == ENV_NOT_RUNNABLE)
+		target->env_status = ENV_RUNNABLE; /* Wake up the blocking recver */
 	spin_unlock(&target->env_lock);
 	return 0;
 }
 
+// Try to send 'value' along with 'npages' pages to the target env 'envid'.
+// srcvas[i] names the i'th page in our address space; it is mapped at
+// env_ipc_dstva + i*PGSIZE in the target, up to the number of pages the
+// target agreed to receive.  The target's env_ipc_npages is then the
+// number of pages mapped, which may be fewer than the sender claims.
+// Fresh mappings are installed without a TLB shootdown, so a whole range
+// costs one trap instead of one IPC per page.
+// Returns the number of pages mapped on success, < 0 on error.
+static int
+sys_ipc_try_send_pages(envid_t envid, uint32_t value, uintptr_t *srcvas, int npages, unsigned perm)
+{
+	struct Env *target;
+	struct Page *p;
+	pte_t *pte;
+	int i, r;
+	if ((r = envid2env(envid, &target, 0)) < 0)
+		return r;
+
+	// Bound npages before the multiply: a huge count would wrap the
+	// length checked to something small
+	if (npages < 0 || npages > PGSIZE)
+		return -E_INVAL;
+	user_mem_assert(curenv, srcvas, npages * sizeof(uintptr_t), 0);
+
+	if (!(perm & PTE_U) || !(perm & PTE_P) || perm & ~PTE_USER)
+		return -E_INVAL;
+
+	if (!target->env_ipc_recving)
+		return -E_IPC_NOT_RECV;
+	spin_lock(&target->env_lock);
+	if (npages > target->env_ipc_npages)
+		npages = target->env_ipc_npages;
+	for (i = 0; i < npages; i++) {
+		if (srcvas[i] >= UTOP || srcvas[i] % PGSIZE ||
+		    !(p = page_lookup(curenv->env_pgdir, (void *)srcvas[i], &pte)) ||
+		    ((perm & PTE_W) && !(*pte & PTE_W))) {
+			r = -E_INVAL;
+			goto fail;
+		}
+		if ((r = page_insert_fresh(target->env_pgdir, p,
+					   target->env_ipc_dstva + i * PGSIZE, perm)) < 0)
+			goto fail;
+	}
+
+	target->env_ipc_recving = 0;
+	target->env_ipc_from = curenv->env_id;
+	target->env_ipc_value = value;
+	target->env_ipc_perm = npages ? perm : 0;
+	target->env_ipc_npages = npages;
+	if (target->env_status == ENV_NOT_RUNNABLE)
+		target->env_status = ENV_RUNNABLE; /* Wake up the blocking recver */
+	spin_unlock(&target->env_lock);
+	return npages;
+
+fail:
+	/* Leave the receiver as it was; it is still waiting */
+	while (--i >= 0)
+		page_remove(target->env_pgdir, target->env_ipc_dstva + i * PGSIZE);
+	spin_unlock(&target->env_lock);
+	return r;
+}
+
 // Block until a value is ready.  Record that you want to receive
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
+// 'npages' is the number of pages we accept at dstva, 0 meaning just one.
+// With 'nonblock' set, only record that we want to receive and return at
+// once; the receive has completed when env_ipc_recving drops to 0, and
+// sys_ipc_wait sleeps until it does.
 // return 0 on success.
 // Return < 0 on error.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, int npages, bool nonblock)
 {
 	spin_lock(&curenv->env_lock);
+	curenv->env_ipc_npages = 0;
 	if (dstva) {
-		if ((uintptr_t)dstva >= UTOP || (uintptr_t)dstva % PGSIZE) {
+		if (npages <= 0)
+			npages = 1;
+		if ((uintptr_t)dstva >= UTOP || (uintptr_t)dstva % PGSIZE ||
+		    npages > (UTOP - (uintptr_t)dstva) / PGSIZE) {
 			spin_unlock(&curenv->env_lock);
 			return -E_INVAL;
 		}
 		curenv->env_ipc_dstva = dstva;
+		curenv->env_ipc_npages = npages;
 	}
 	assert(curenv->env_status == ENV_RUNNING);
 	curenv->env_ipc_recving = 1;
+	if (nonblock) {
+		spin_unlock(&curenv->env_lock);
+		return 0;
+	}
 	curenv->env_status = ENV_NOT_RUNNABLE; /* Go blocking(sleep) */
 	curenv->env_tf.tf_regs.reg_eax = 0; /* Ensure syscall eventually return 0 */
 	spin_unlock(&curenv->env_lock);
 	sched_yield();
 }
 
+// Sleep until the receive started by a non-blocking sys_ipc_recv
+// completes, or the clock reaches 'msec', or, with 'nic' set, the NIC
+// receives a frame.  Returns 0 then, or at once if one of them already
+// has happened.  (uint32_t)~0 means no timeout.
+static int
+sys_ipc_wait(uint32_t msec, bool nic)
+{
+	spin_lock(&curenv->env_lock);
+	if (!curenv->env_ipc_recving || time_msec() >= msec) {
+		spin_unlock(&curenv->env_lock);
+		return 0;
+	}
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	curenv->env_wakeup = msec;
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	spin_unlock(&curenv->env_lock);
+	if (nic && e100_rx_sleep(curenv->env_id) < 0) {
+		spin_lock(&curenv->env_lock);
+		curenv->env_status = ENV_RUNNING;
+		curenv->env_wakeup = ~0;
+		spin_unlock(&curenv->env_lock);
+		return 0;
+	}
+	sched_yield();
+}
+
 static int
 sys_time_msec()
 {
@@ -326,15 +431,260 @@ sys_time_msec()
 static int
 sys_nic_send(char *packet, int size)
 {
+	int r;
+
+	if ((r = e100_ring_reclaim()) < 0)
+		return r;
 	return e100_add_tcb(packet, size);
 }
 
+// Check the nseg pieces of a frame for SYS_nic_send_sg and
+// SYS_nic_send_batch, which must all be mapped in the caller.  'segs'
+// is the kernel's own copy of the caller's array, so the caller cannot
+// change it between this check and nic_frame_tbd.
+static int
+nic_frame_check(const struct nic_seg *segs, int nseg)
+{
+	int i, total;
+
+	if (nseg <= 0 || nseg > NIC_MAXSEGS)
+		return -E_INVAL;
+	total = 0;
+	for (i = 0; i < nseg; i++) {
+		if (segs[i].ns_len > E100_MAX_PKT_SIZE ||
+		    (total += segs[i].ns_len) > E100_MAX_PKT_SIZE)
+			return -E_INVAL;
+		user_mem_assert(curenv, segs[i].ns_va, segs[i].ns_len, PTE_P);
+	}
+	return total ? 0 : -E_INVAL;
+}
+
+// Turn the pieces of a checked frame into TBDs, one for each part of a
+// piece within a page.  Returns the number of TBDs, or -E_INVAL if a page
+// has gone meanwhile.
+static int
+nic_frame_tbd(const struct nic_seg *segs, int nseg, struct Tbd *tbd)
+{
+	struct Page *pp;
+	const char *va;
+	int i, n, len;
+
+	n = 0;
+	for (i = 0; i < nseg; i++) {
+		va = segs[i].ns_va;
+		len = segs[i].ns_len;
+		while (len > 0) {
+			if (n == E100_MAX_TBD)
+				return -E_INVAL;
+			if (!(pp = page_lookup(curenv->env_pgdir, (void *)va, 0)))
+				return -E_INVAL;
+			tbd[n].addr = page2pa(pp) + PGOFF(va);
+			tbd[n].size = MIN(len, (int) (PGSIZE - PGOFF(va)));
+			tbd[n].el = 0;
+			va += tbd[n].size;
+			len -= tbd[n].size;
+			n++;
+		}
+	}
+	return n;
+}
+
+// Send the frame made up of the nseg pieces in 'segs' without copying
+// it: the NIC fetches the pieces from the caller's pages.  Transmit
+// progress goes to *st in any case; with nseg 0 that is all it does.
+// Returns 0 on success, or -1 if the frame was dropped.
+static int
+sys_nic_send_sg(const struct nic_seg *segs, int nseg, struct nic_txstat *st)
+{
+	struct nic_seg ksegs[NIC_MAXSEGS];
+	struct Tbd tbd[E100_MAX_TBD];
+	int n, r;
+
+	user_mem_assert(curenv, st, sizeof(*st), PTE_P | PTE_W);
+	if (nseg > 0 && nseg <= NIC_MAXSEGS) {
+		user_mem_assert(curenv, segs, nseg * sizeof(*segs), PTE_P);
+		memmove(ksegs, segs, nseg * sizeof(*segs));
+	}
+	if (nseg == 0 || (r = nic_frame_check(ksegs, nseg)) < 0) {
+		e100_txstat(st);
+		return nseg ? r : 0;
+	}
+	if ((r = e100_ring_reclaim()) < 0)
+		return r;
+
+	e100_tx_begin();
+	if ((n = nic_frame_tbd(ksegs, nseg, tbd)) < 0 ||
+	    (r = e100_tx_add(tbd, n)) < 0)
+		r = -1;
+	e100_tx_end(st);
+	return r;
+}
+
+// Send the nframes frames in 'frames' as sys_nic_send_sg does, ringing
+// the NIC once for all of them.  Returns the number of frames queued,
+// which are the first ones: the rest were dropped for a full CBL.
+// Returns < 0, queuing none, if a frame is bad.
 static int
-sys_nic_recv(char *packet, int *size)
+sys_nic_send_batch(const struct nic_frame *frames, int nframes, struct nic_txstat *st)
 {
+	struct nic_frame kframes[NIC_MAXBATCH];
+	struct Tbd tbd[E100_MAX_TBD];
+	int i, n, r;
+
+	if (nframes < 0 || nframes > NIC_MAXBATCH)
+		return -E_INVAL;
+	user_mem_assert(curenv, frames, nframes * sizeof(*frames), PTE_P);
+	user_mem_assert(curenv, st, sizeof(*st), PTE_P | PTE_W);
+	memmove(kframes, frames, nframes * sizeof(*frames));
+	for (i = 0; i < nframes; i++)
+		if ((r = nic_frame_check(kframes[i].nf_seg, kframes[i].nf_nseg)) < 0) {
+			e100_txstat(st);
+			return r;
+		}
+	if ((r = e100_ring_reclaim()) < 0)
+		return r;
+
+	e100_tx_begin();
+	for (i = 0; i < nframes; i++)
+		if ((n = nic_frame_tbd(kframes[i].nf_seg, kframes[i].nf_nseg, tbd)) < 0 ||
+		    e100_tx_add(tbd, n) < 0)
+			break;
+	e100_tx_end(st);
+	return i;
+}
+
+static int
+sys_nic_stats(struct nic_stats *st)
+{
+	user_mem_assert(curenv, st, sizeof(*st), PTE_P | PTE_W);
+	e100_stats(st);
+	return 0;
+}
+
+// Sleep until the NIC receives a frame.  The syscall that calls this
+// returns 'woken' then, or at once if a frame has come in meanwhile: the
+// caller is to try again.
+static int
+nic_sleep(int woken)
+{
+	// Go to sleep before the driver can see us waiting, so that
+	// the wakeup cannot be missed
+	spin_lock(&curenv->env_lock);
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	curenv->env_tf.tf_regs.reg_eax = woken;
+	spin_unlock(&curenv->env_lock);
+	if (e100_rx_sleep(curenv->env_id) < 0) {
+		spin_lock(&curenv->env_lock);
+		curenv->env_status = ENV_RUNNING;
+		spin_unlock(&curenv->env_lock);
+		return woken;
+	}
+	sched_yield();
+}
+
+// Receive a frame into 'packet' and its length into *size.
+// Returns 0 on success, or -1 if there is no frame waiting.  With 'block'
+// set, sleep until the next frame comes in instead of failing, and then
+// return 1: the caller is to try again.
+static int
+sys_nic_recv(char *packet, int *size, bool block)
+{
+	int r;
+
+	if ((r = e100_ring_reclaim()) < 0)
+		return r;
 	user_mem_assert(curenv, packet, E100_MAX_PKT_SIZE, PTE_P | PTE_W);
-	return e100_rem_rfd(packet, size);
+	user_mem_assert(curenv, size, sizeof(int), PTE_P | PTE_W);
+	if (e100_rem_rfd(packet, size) == 0)
+		return 0;
+	if (!block)
+		return -1;
+	return nic_sleep(1);
 }
+
+// Receive a frame without copying it: the page the NIC received it into
+// is mapped at 'va', holding a struct jif_pkt at NIC_PKTOFF, and the NIC
+// gets a fresh page instead.  Returns and blocks as sys_nic_recv.
+static int
+sys_nic_recv_page(void *va, bool block)
+{
+	struct Page *pp;
+	int r;
+
+	if ((uintptr_t)va >= UTOP || (uintptr_t)va % PGSIZE)
+		return -E_INVAL;
+	if ((r = e100_ring_reclaim()) < 0)
+		return r;
+	if ((r = e100_rem_rfd_page(&pp)) >= 0) {
+		if ((r = page_insert(curenv->env_pgdir, pp, va, PTE_U|PTE_P|PTE_W)) < 0) {
+			page_free(pp);	/* drop the frame */
+			return r;
+		}
+		return 0;
+	}
+	if (r != -1 || !block)
+		return r;
+	return nic_sleep(1);
+}
+
+// Receive up to n frames as sys_nic_recv_page does, mapping them at va,
+// va + PGSIZE and so on.  Returns the number received.  With 'block' set
+// and no frame waiting, sleep until one comes in and return 0: the
+// caller is to try again.
+static int
+sys_nic_recv_pages(void *va, int n, bool block)
+{
+	struct Page *pp;
+	int i, r;
+
+	if ((uintptr_t)va >= UTOP || (uintptr_t)va % PGSIZE ||
+	    n <= 0 || n > (UTOP - (uintptr_t)va) / PGSIZE)
+		return -E_INVAL;
+	if ((r = e100_ring_reclaim()) < 0)
+		return r;
+	for (i = 0; i < n; i++) {
+		if ((r = e100_rem_rfd_page(&pp)) < 0)
+			break;
+		if ((r = page_insert(curenv->env_pgdir, pp, va + i * PGSIZE,
+				     PTE_U|PTE_P|PTE_W)) < 0) {
+			page_free(pp);	/* drop the frame */
+			break;
+		}
+	}
+	if (i > 0)
+		return i;
+	if (r != -1)
+		return r;
+	if (!block)
+		return 0;
+	return nic_sleep(0);
+}
+
+// Map the NIC rings at va, NIC_RING_SIZE bytes at most, to move frames
+// through them without trapping (see struct nic_ring).  The other NIC
+// syscalls fail with -E_BAD_ENV, in every env, until the caller exits.
+static int
+sys_nic_ring_map(void *va)
+{
+	return e100_ring_map(curenv, (uintptr_t)va);
+}
+
+// Ring the doorbell of the rings the caller mapped: send the frames it
+// filled in, and let the NIC reuse the receive slots it is done with.
+static int
+sys_nic_ring_sync(void)
+{
+	return e100_ring_sync(curenv->env_id);
+}
+
+// Sleep until the NIC has a frame for whoever takes frames from it.
+// Returns 0 then, or at once if one is waiting already.
+static int
+sys_nic_wait(void)
+{
+	return nic_sleep(0);
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
 int32_t
 syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
@@ -384,8 +734,14 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	case SYS_ipc_try_send:
 		return sys_ipc_try_send((envid_t)a1, (uint32_t)a2, (void *)a3, (unsigned)a4);
 
+	case SYS_ipc_try_send_pages:
+		return sys_ipc_try_send_pages((envid_t)a1, (uint32_t)a2, (uintptr_t *)a3, (int)a4, (unsigned)a5);
+
 	case SYS_ipc_recv:
-		return sys_ipc_recv((void *)a1); /* Never return */
+		return sys_ipc_recv((void *)a1, (int)a2, (bool)a3); /* Never return if blocking */
+
+	case SYS_ipc_wait:
+		return sys_ipc_wait(a1, (bool)a2);
 
 	case SYS_time_msec:
 		return sys_time_msec();
@@ -394,7 +750,25 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		return sys_nic_send((char *)a1, (int)a2);
 
 	case SYS_nic_recv:
-		return sys_nic_recv((char *)a1, (int *)a2);
+		return sys_nic_recv((char *)a1, (int *)a2, (bool)a3);
+	case SYS_nic_recv_page:
+		return sys_nic_recv_page((void *)a1, (bool)a2);
+	case SYS_nic_send_sg:
+		return sys_nic_send_sg((const struct nic_seg *)a1, (int)a2,
+				       (struct nic_txstat *)a3);
+	case SYS_nic_send_batch:
+		return sys_nic_send_batch((const struct nic_frame *)a1, (int)a2,
+					  (struct nic_txstat *)a3);
+	case SYS_nic_recv_pages:
+		return sys_nic_recv_pages((void *)a1, (int)a2, (bool)a3);
+	case SYS_nic_ring_map:
+		return sys_nic_ring_map((void *)a1);
+	case SYS_nic_ring_sync:
+		return sys_nic_ring_sync();
+	case SYS_nic_wait:
+		return sys_nic_wait();
+	case SYS_nic_stats:
+		return sys_nic_stats((struct nic_stats *)a1);
 
 	default:
 		panic("Unknown system call!");
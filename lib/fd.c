@@ -308,15 +308,3 @@ fstat(int fdnum, struct Stat *stat)
 	return (*dev->dev_stat)(fd, stat);
 }
 
-int
-stat(const char *path, struct Stat *stat)
-{
-	int fd, r;
-
-	if ((fd = open(path, O_RDONLY)) < 0)
-		return fd;
-	r = fstat(fd, stat);
-	close(fd);
-	return r;
-}
-
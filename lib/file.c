@@ -22,9 +22,41 @@ struct Dev devfile =
 };
 
 // Helper functions for file access
-static int fmap(struct Fd *fd, off_t oldsize, off_t newsize);
+static int fpagein(struct Fd *fd, off_t offset, size_t n);
+static int fprealloc(struct Fd *fd, off_t size);
 static int funmap(struct Fd *fd, off_t oldsize, off_t newsize, bool dirty);
 
+// Number of pages fetched beyond the ones being touched, so sequential
+// readers don't pay one IPC per page.
+#define FILE_READAHEAD	16
+
+// Number of blocks reserved past the end of a file a write extends, so
+// an appending writer asks the server for more room only now and then.
+#define FILE_PREALLOC	16
+
+// stat() results are kept for STATCACHE_MSEC, so a burst of stats of
+// the same paths costs one request each.  Changing a file from this
+// environment empties the cache; changes made by others may go unseen
+// for that long.
+#define NSTATCACHE	16
+#define STATCACHE_MSEC	100
+
+static struct StatCache {
+	char sc_path[MAXPATHLEN];
+	unsigned sc_time;
+	struct Stat sc_stat;
+} statcache[NSTATCACHE];
+static int statcache_next;
+
+static void
+statcache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < NSTATCACHE; i++)
+		statcache[i].sc_path[0] = 0;
+}
+
 // Open a file (or directory),
 // returning the file descriptor index on success, < 0 on failure.
 int
@@ -46,6 +78,9 @@ open(const char *path, int mode)
 	if ((r = fd_alloc(&fd)) < 0)
 		return r;
 
+	if (mode & (O_CREAT|O_TRUNC|O_MKDIR))
+		statcache_flush();
+
 	/* Struct Fd was allocated in openfile_alloc */
 
 	if ((r = fsipc_open(path, mode, fd)) < 0){
@@ -54,14 +89,63 @@ open(const char *path, int mode)
 	}
 	if (debug)
 		cprintf("open %s\n", fd->fd_file.file.f_name);
-	
-	if ((r = fmap(fd, 0, fd->fd_file.file.f_size)) < 0) {
-		fd_close(fd, 0);
-		return r;
-	} 
+
+	/* File data is paged in on first access (see fpagein), so opening
+	 * a file costs the same whatever its size.
+	 */
 	return fd2num(fd);
 }
 
+// Get the attributes of the file at path without opening it.
+int
+stat(const char *path, struct Stat *st)
+{
+	int i, r;
+	unsigned now;
+	struct StatCache *sc;
+
+	now = sys_time_msec();
+	for (i = 0; i < NSTATCACHE; i++) {
+		sc = &statcache[i];
+		if (sc->sc_path[0] && now - sc->sc_time < STATCACHE_MSEC
+		    && strcmp(sc->sc_path, path) == 0) {
+			*st = sc->sc_stat;
+			return 0;
+		}
+	}
+
+	if ((r = fsipc_stat(path, st)) < 0)
+		return r;
+	st->st_dev = &devfile;
+
+	// fsipc_stat has rejected paths that would not fit in sc_path
+	sc = &statcache[statcache_next++ % NSTATCACHE];
+	strcpy(sc->sc_path, path);
+	sc->sc_time = now;
+	sc->sc_stat = *st;
+	return 0;
+}
+
+// Read up to n entries of the directory open as fdnum into d, starting
+// at its seek position, NDIRENT entries per request to the server.
+// Returns the number of entries read, 0 at the end of the directory.
+int
+readdir(int fdnum, struct Dirent *d, int n)
+{
+	int r, tot;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	for (tot = 0; tot < n; tot += r)
+		if ((r = fsipc_readdir(fd->fd_file.id, &fd->fd_offset,
+				       d + tot, n - tot)) <= 0)
+			break;
+	return tot > 0 ? tot : r;
+}
+
 // Clean up a file-server file descriptor.
 // This function is called by fd_close.
 static int
@@ -72,12 +156,16 @@ file_close(struct Fd *fd)
 	// (to free up its resources).
 
 	// LAB 5: Your code here.
-	int r;
+	int r, fileid;
 	if ((r = funmap(fd, fd->fd_file.file.f_size, 0, 1)) < 0)
 		return r;
 	if (debug)
 		cprintf("close %s\n", fd->fd_file.file.f_name); 
-	return fsipc_close(fd->fd_file.id);
+	// Drop the Fd page first, so the server can tell whether we were
+	// the last user of its open-file entry.
+	fileid = fd->fd_file.id;
+	sys_page_unmap(0, fd);
+	return fsipc_close(fileid);
 }
 
 // Read 'n' bytes from 'fd' at the current seek position into 'buf'.
@@ -87,6 +175,7 @@ static ssize_t
 file_read(struct Fd *fd, void *buf, size_t n, off_t offset)
 {
 	size_t size;
+	int r;
 
 	// avoid reading past the end of file
 	size = fd->fd_file.file.f_size;
@@ -96,6 +185,8 @@ file_read(struct Fd *fd, void *buf, size_t n, off_t offset)
 		n = size - offset;
 
 	// read the data by copying from the file mapping
+	if ((r = fpagein(fd, offset, n)) < 0)
+		return r;
 	memmove(buf, fd2data(fd) + offset, n);
 	return n;
 }
@@ -116,6 +207,9 @@ read_map(int fdnum, off_t offset, void **blk)
 	va = fd2data(fd) + offset;
 	if (offset >= MAXFILESIZE)
 		return -E_NO_DISK;
+	if (offset < fd->fd_file.file.f_size
+	    && (r = fpagein(fd, offset, 1)) < 0)
+		return r;
 	if (!(vpd[PDX(va)] & PTE_P) || !(vpt[VPN(va)] & PTE_P))
 		return -E_NO_DISK;
 	*blk = (void*) va;
@@ -133,13 +227,23 @@ file_write(struct Fd *fd, const void *buf, size_t n, off_t offset)
 	if (tot > MAXFILESIZE)
 		return -E_NO_DISK;
 
-	// increase the file's size if necessary
+	// increase the file's size if necessary.  Within the blocks
+	// reserved for the file that is just a store to the Fd page,
+	// which the server takes up the next time it looks at the file.
 	if (tot > fd->fd_file.file.f_size) {
-		if ((r = file_trunc(fd, tot)) < 0)
+		if (tot > fd->fd_file.reserved)
+			fprealloc(fd, MIN(ROUNDUP(tot, BLKSIZE) + FILE_PREALLOC * BLKSIZE,
+					  MAXFILESIZE));
+		if (tot <= fd->fd_file.reserved) {
+			statcache_flush();
+			fd->fd_file.file.f_size = tot;
+		} else if ((r = file_trunc(fd, tot)) < 0)
 			return r;
 	}
 
 	// write the data
+	if ((r = fpagein(fd, offset, n)) < 0)
+		return r;
 	memmove(fd2data(fd) + offset, buf, n);
 	if (debug)
 		cprintf("write to %s\n", fd->fd_file.file.f_name); 
@@ -168,40 +272,81 @@ file_trunc(struct Fd *fd, off_t newsize)
 
 	fileid = fd->fd_file.id;
 	oldsize = fd->fd_file.file.f_size;
+	statcache_flush();
 	if ((r = fsipc_set_size(fileid, newsize)) < 0)
 		return r;
 	assert(fd->fd_file.file.f_size == newsize);
+	if (newsize < oldsize)
+		fd->fd_file.reserved = MIN(fd->fd_file.reserved, newsize);
 
-	if ((r = fmap(fd, oldsize, newsize)) < 0)
-		return r;
+	/* Growing needs no mapping now; new pages come in on first touch */
 	funmap(fd, oldsize, newsize, 0);
 
 	return 0;
 }
 
-// Call the file system server to obtain and map file pages
-// when the size of the file as mapped in our memory increases.
-// Harmlessly does nothing if oldsize >= newsize.
-// Returns 0 on success, < 0 on error.
-// If there is an error, unmaps any newly allocated pages.
+// Reserve blocks for the file up to 'size' bytes without changing its
+// size; writes can then extend the file that far without asking the
+// server.  The reservation ends when the file is closed.
 static int
-fmap(struct Fd* fd, off_t oldsize, off_t newsize)
+fprealloc(struct Fd *fd, off_t size)
 {
-	size_t i;
-	char *va;
 	int r;
 
-	// Hint: Use fsipc_map.
-	// Hint: Remember to unmap any pages you mapped if 
-	// an error occurs.
+	if (size > MAXFILESIZE)
+		return -E_NO_DISK;
+	if ((r = fsipc_prealloc(fd->fd_file.id, size)) < 0)
+		return r;
+	fd->fd_file.reserved = r;
+	return 0;
+}
+
+int
+preallocate(int fdnum, off_t size)
+{
+	int r;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	return fprealloc(fd, size);
+}
+
+static bool
+va_is_mapped(void *va)
+{
+	return (vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P);
+}
+
+// Make sure the file pages backing [offset, offset + n) are mapped,
+// asking the file server for each missing run with one FSREQ_MAP_RANGE.
+// A run extends up to FILE_READAHEAD pages past the requested range,
+// but never beyond the end of the file or over a page already present.
+// Returns 0 on success, < 0 on failure.
+static int
+fpagein(struct Fd *fd, off_t offset, size_t n)
+{
+	off_t i, j, end, lim;
+	char *va;
+	int r;
 
-	// LAB 5: Your code here.
 	va = fd2data(fd);
-	for (i = ROUNDUP(oldsize, PGSIZE); i < newsize; i += PGSIZE) {
-		if ((r = fsipc_map(fd->fd_file.id, i, va + i)) < 0) {
-			funmap(fd, i, oldsize, 0);
-			return r;
+	lim = ROUNDUP(fd->fd_file.file.f_size, PGSIZE);
+	end = MIN(ROUNDUP(offset + n, PGSIZE), lim);
+	lim = MIN(end + FILE_READAHEAD * PGSIZE, lim);
+	for (i = ROUNDDOWN(offset, PGSIZE); i < end; i = j) {
+		if (va_is_mapped(va + i)) {
+			j = i + PGSIZE;
+			continue;
 		}
+		for (j = i + PGSIZE; j < lim && !va_is_mapped(va + j)
+			     && (j - i) / PGSIZE < MAXMAPPAGES; j += PGSIZE)
+			/* extend the run */;
+		if ((r = fsipc_map_range(fd->fd_file.id, i, (j - i) / PGSIZE, va + i)) <= 0)
+			return r < 0 ? r : -E_INVAL;
+		j = i + r * PGSIZE;
 	}
 	return 0;
 }
@@ -225,8 +370,8 @@ funmap(struct Fd* fd, off_t oldsize, off_t newsize, bool dirty)
 	ret = 0;
 	va = fd2data(fd);
 	for (i = ROUNDUP(newsize, PGSIZE); i < oldsize; i += PGSIZE)
-		if (vpt[VPN(va + i)] & PTE_P) {
-			if (dirty && (vpt[VPN(va)] & PTE_D)
+		if (va_is_mapped(va + i)) {
+			if (dirty && (vpt[VPN(va + i)] & PTE_D)
 			    && (r = fsipc_dirty(fd->fd_file.id, i)) < 0)
 				ret = r;
 			sys_page_unmap(0, va + i);
@@ -238,6 +383,7 @@ funmap(struct Fd* fd, off_t oldsize, off_t newsize, bool dirty)
 int
 remove(const char *path)
 {
+	statcache_flush();
 	return fsipc_remove(path);
 }
 
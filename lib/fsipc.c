@@ -72,6 +72,34 @@ fsipc_map(int fileid, off_t offset, void *dstva)
 	return 0;
 }
 
+// Ask the file server to map up to 'npages' consecutive file blocks,
+// starting at the block-aligned 'offset', at consecutive pages from 'dstva'.
+// The whole run comes back in one IPC.
+// Returns the number of pages mapped on success, < 0 on failure.
+int
+fsipc_map_range(int fileid, off_t offset, int npages, void *dstva)
+{
+	int r, perm;
+	envid_t whom;
+	struct Fsreq_map_range *req;
+
+	req = (struct Fsreq_map_range*) fsipcbuf;
+	req->req_fileid = fileid;
+	req->req_offset = offset;
+	req->req_npages = npages;
+
+	if (debug)
+		cprintf("[%08x] fsipc %d %08x\n", env->env_id, FSREQ_MAP_RANGE, fsipcbuf);
+
+	ipc_send(envs[1].env_id, FSREQ_MAP_RANGE, req, PTE_P | PTE_W | PTE_U);
+	if ((r = ipc_recv_pages(&whom, dstva, npages, &perm)) < 0)
+		return r;
+
+	if (!(perm & PTE_U) || !(perm & PTE_P))
+		return -E_INVAL;
+	return r;
+}
+
 // Make a set-file-size request to the file server.
 int
 fsipc_set_size(int fileid, off_t size)
@@ -84,6 +112,19 @@ fsipc_set_size(int fileid, off_t size)
 	return fsipc(FSREQ_SET_SIZE, req, 0, 0);
 }
 
+// Ask the file server to allocate blocks for a file up to 'size' bytes.
+// Returns the number of bytes the file has blocks for, < 0 on failure.
+int
+fsipc_prealloc(int fileid, off_t size)
+{
+	struct Fsreq_prealloc *req;
+
+	req = (struct Fsreq_prealloc*) fsipcbuf;
+	req->req_fileid = fileid;
+	req->req_size = size;
+	return fsipc(FSREQ_PREALLOC, req, 0, 0);
+}
+
 // Make a file-close request to the file server.
 // After this the fileid is invalid.
 int
@@ -122,6 +163,45 @@ fsipc_remove(const char *path)
 	return fsipc(FSREQ_REMOVE, req, 0, 0);
 }
 
+// Ask the file server for the attributes of the file at path.
+int
+fsipc_stat(const char *path, struct Stat *st)
+{
+	int r;
+	struct Fsreq_stat *req;
+
+	req = (struct Fsreq_stat*) fsipcbuf;
+	if (strlen(path) >= MAXPATHLEN)
+		return -E_BAD_PATH;
+	strcpy(req->req_path, path);
+	if ((r = fsipc(FSREQ_STAT, req, 0, 0)) < 0)
+		return r;
+	strcpy(st->st_name, req->ret_name);
+	st->st_size = req->ret_size;
+	st->st_isdir = req->ret_isdir;
+	return 0;
+}
+
+// Read up to n entries (at most NDIRENT) of an open directory into d,
+// starting at byte offset *offset, and advance *offset past them.
+// Returns the number of entries read, 0 at the end of the directory.
+int
+fsipc_readdir(int fileid, off_t *offset, struct Dirent *d, int n)
+{
+	int r;
+	struct Fsreq_readdir *req;
+
+	req = (struct Fsreq_readdir*) fsipcbuf;
+	req->req_fileid = fileid;
+	req->req_offset = *offset;
+	req->req_n = MIN(n, NDIRENT);
+	if ((r = fsipc(FSREQ_READDIR, req, 0, 0)) < 0)
+		return r;
+	memmove(d, req->ret_ents, r * sizeof(struct Dirent));
+	*offset = req->req_offset;
+	return r;
+}
+
 // Ask the file server to update the disk
 // by writing any dirty blocks in the buffer cache.
 int
@@ -130,3 +210,18 @@ fsipc_sync(void)
 	return fsipc(FSREQ_SYNC, fsipcbuf, 0, 0);
 }
 
+// Fetch the server's latency statistics, one FsLatency per request code,
+// into lat[NFSREQ].  If reset is set, the server starts counting over.
+int
+fsipc_stats(struct FsLatency *lat, bool reset)
+{
+	int r;
+	struct Fsreq_stats *req;
+
+	req = (struct Fsreq_stats*) fsipcbuf;
+	req->req_reset = reset;
+	if ((r = fsipc(FSREQ_STATS, req, 0, 0)) < 0)
+		return r;
+	memmove(lat, req->ret_lat, sizeof(req->ret_lat));
+	return 0;
+}
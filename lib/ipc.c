@@ -43,3 +43,38 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 		panic("icp_send %e", r);
 }
 
+
+// Like ipc_recv, but accept up to 'npages' pages mapped contiguously
+// starting at 'pg'.
+int32_t
+ipc_recv_pages(envid_t *from_env_store, void *pg, int npages, int *perm_store)
+{
+	int r;
+	if ((r = sys_ipc_recv_pages(pg, npages)) < 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (perm_store)
+			*perm_store = 0;
+		return r;
+	}
+	if (from_env_store)
+		*from_env_store = env->env_ipc_from;
+	if (perm_store)
+		*perm_store = env->env_ipc_perm;
+
+	return env->env_ipc_value;
+}
+
+// Send 'val' and the 'npages' pages listed in 'pgs' to 'toenv' in one
+// trap.  Keeps trying until the receiver is waiting.
+// Returns the number of pages the receiver actually got.
+int
+ipc_send_pages(envid_t to_env, uint32_t val, uintptr_t *pgs, int npages, int perm)
+{
+	int r;
+	while ((r = sys_ipc_try_send_pages(to_env, val, pgs, npages, perm)) == -E_IPC_NOT_RECV)
+		sys_yield();
+	if (r < 0)
+		panic("ipc_send_pages %e", r);
+	return r;
+}
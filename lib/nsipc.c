@@ -101,9 +101,29 @@ nsipc_listen(int s, int backlog) {
     return nsipc(NSREQ_LISTEN, req, 0, &perm);
 }
 
+// Set up pgs to lend the server the request page 'req', then the pages
+// holding the 'len' bytes at 'buf', at most NSMAXSENDPAGES of them.
+// Fills in the request's offset and page count and returns the number
+// of bytes that fit.
+static int
+nsipc_lend(int *offset, int *npages, const void *buf, int len,
+	   uintptr_t *pgs, void *req) {
+    int i;
+
+    *offset = PGOFF(buf);
+    len = MIN(len, NSMAXSENDPAGES * PGSIZE - *offset);
+    *npages = ROUNDUP(*offset + len, PGSIZE) / PGSIZE;
+    pgs[0] = (uintptr_t) req;
+    for (i = 0; i < *npages; i++)
+	pgs[1 + i] = ROUNDDOWN((uintptr_t) buf, PGSIZE) + i * PGSIZE;
+    return len;
+}
+
 int
 nsipc_recv(int s, void *mem, int len, unsigned int flags) {
-    int perm, r;
+    int i, perm, r;
+    envid_t whom;
+    uintptr_t pgs[1 + NSMAXSENDPAGES];
     struct Nsreq_recv *req;
     void *ret;
 
@@ -111,28 +131,65 @@ nsipc_recv(int s, void *mem, int len, unsigned int flags) {
     req->req_s = s;
     req->req_len = len;
     req->req_flags = flags;
-	   
-    r = nsipc(NSREQ_RECV, req, (void *)REQVA, &perm);
+    req->req_npages = 0;
 
-    assert(r < 1600 && r <= len);
-    ret = (void *) REQVA;
-    memmove(mem, ret, r);
+    // Up to a page comes back in the reply page
+    if (len <= PGSIZE) {
+	r = nsipc(NSREQ_RECV, req, (void *)REQVA, &perm);
 
-    return r;
+	assert(r <= len);
+	ret = (void *) REQVA;
+	if (r > 0)
+	    memmove(mem, ret, r);
+	return r;
+    }
+
+    // More goes straight into our pages.  They are lent writable, so
+    // copy any still shared copy-on-write first.
+    req->req_len = nsipc_lend(&req->req_offset, &req->req_npages,
+			      mem, len, pgs, req);
+    for (i = 0; i < req->req_npages; i++)
+	*(volatile char *) pgs[1 + i] = *(volatile char *) pgs[1 + i];
+
+    if (debug)
+	cprintf("[%08x] nsipc %d %08x\n", env->env_id, NSREQ_RECV, nsipcbuf);
+
+    ipc_send_pages(envs[2].env_id, NSREQ_RECV, pgs, 1 + req->req_npages,
+		   PTE_P|PTE_W|PTE_U);
+    return ipc_recv(&whom, 0, &perm);
 }
 
+// Returns the number of bytes sent, which may be short of 'size': the
+// server takes up to NSMAXSENDPAGES pages a request.  See send.
 int
 nsipc_send(int s, const void *dataptr, int size, unsigned int flags) {
     int perm;
+    envid_t whom;
+    uintptr_t pgs[1 + NSMAXSENDPAGES];
     struct Nsreq_send *req;
 
     req = (struct Nsreq_send*)nsipcbuf;
     req->req_s = s;
-    assert(size < 1600);
-    memmove(&req->req_dataptr, dataptr, size);
-    req->req_size = size;
     req->req_flags = flags;
-    return nsipc(NSREQ_SEND, req, 0, &perm);
+
+    // What fits goes in the request page
+    if (size <= NSMAXINLINE) {
+	memmove(&req->req_dataptr, dataptr, size);
+	req->req_size = size;
+	req->req_npages = 0;
+	return nsipc(NSREQ_SEND, req, 0, &perm);
+    }
+
+    // More stays in our pages, lent to the server
+    req->req_size = nsipc_lend(&req->req_offset, &req->req_npages,
+			       dataptr, size, pgs, req);
+
+    if (debug)
+	cprintf("[%08x] nsipc %d %08x\n", env->env_id, NSREQ_SEND, nsipcbuf);
+
+    ipc_send_pages(envs[2].env_id, NSREQ_SEND, pgs, 1 + req->req_npages,
+		   PTE_P|PTE_U);
+    return ipc_recv(&whom, 0, &perm);
 }
 
 int
@@ -147,3 +204,154 @@ nsipc_socket(int domain, int type, int protocol) {
     return nsipc(NSREQ_SOCKET, req, 0, &perm);
 }
 
+// Send 'size' bytes of the file open as 'fd', starting at 'offset', on
+// socket 's'.  The file pages go to the network server in the same IPC
+// as the request, so the data is never copied on the way.
+int
+nsipc_sendfile(int s, int fd, off_t offset, int size) {
+    int i, r, perm;
+    envid_t whom;
+    void *blk;
+    uintptr_t pgs[1 + NSMAXSENDPAGES];
+    struct Nsreq_sendfile *req;
+
+    req = (struct Nsreq_sendfile*)nsipcbuf;
+    req->req_s = s;
+    req->req_offset = offset % PGSIZE;
+    req->req_size = size;
+    req->req_npages = ROUNDUP(req->req_offset + size, PGSIZE) / PGSIZE;
+    assert(req->req_npages <= NSMAXSENDPAGES);
+
+    pgs[0] = (uintptr_t) req;
+    for (i = 0; i < req->req_npages; i++) {
+	if ((r = read_map(fd, ROUNDDOWN(offset, PGSIZE) + i * PGSIZE, &blk)) < 0)
+	    return r;
+	pgs[1 + i] = (uintptr_t) blk;
+    }
+
+    if (debug)
+	cprintf("[%08x] nsipc %d %08x\n", env->env_id, NSREQ_SENDFILE, nsipcbuf);
+
+    ipc_send_pages(envs[2].env_id, NSREQ_SENDFILE, pgs, 1 + req->req_npages, PTE_P|PTE_U);
+    return ipc_recv(&whom, 0, &perm);
+}
+
+// Share the NSRING_NPAGES pages at 'ring' with the network server as
+// socket 's''s rings; see struct Nsring.
+int
+nsipc_ring(int s, struct Nsring *ring) {
+    int i, perm;
+    envid_t whom;
+    uintptr_t pgs[1 + NSRING_NPAGES];
+    struct Nsreq_ring *req;
+
+    req = (struct Nsreq_ring*)nsipcbuf;
+    req->req_s = s;
+
+    pgs[0] = (uintptr_t) req;
+    for (i = 0; i < NSRING_NPAGES; i++)
+	pgs[1 + i] = (uintptr_t) ring + i * PGSIZE;
+
+    if (debug)
+	cprintf("[%08x] nsipc %d %08x\n", env->env_id, NSREQ_RING, nsipcbuf);
+
+    ipc_send_pages(envs[2].env_id, NSREQ_RING, pgs, 1 + NSRING_NPAGES,
+		   PTE_P|PTE_W|PTE_U|PTE_SHARE);
+    return ipc_recv(&whom, 0, &perm);
+}
+
+// Wait for socket 's''s ring to change from when its sr_events was
+// 'events'.
+int
+nsipc_ringwait(int s, uint32_t events) {
+    int perm;
+    struct Nsreq_ringwait *req;
+
+    req = (struct Nsreq_ringwait*)nsipcbuf;
+    req->req_s = s;
+    req->req_events = events;
+    return nsipc(NSREQ_RINGWAIT, req, 0, &perm);
+}
+
+// Have the network server look at the rings again.  There is no reply.
+void
+nsipc_ringkick(void) {
+    ipc_send(envs[2].env_id, NSREQ_RINGKICK, 0, 0);
+}
+
+// Wait up to 'timeout' msec (< 0 for as long as it takes) for any of the
+// 'nfds' sockets in 'fds' to be ready; fills in their revents.
+// Returns the number that are.
+int
+nsipc_poll(struct pollfd *fds, int nfds, int timeout) {
+    int i, perm, r;
+    struct Nsreq_poll *req, *ret;
+
+    if (nfds < 0 || nfds > NSMAXSOCKETS)
+	return -E_INVAL;
+
+    req = (struct Nsreq_poll*)nsipcbuf;
+    req->req_nfds = nfds;
+    req->req_timeout = timeout;
+    memmove(req->req_fds, fds, nfds * sizeof(fds[0]));
+
+    if ((r = nsipc(NSREQ_POLL, req, (void *)REQVA, &perm)) < 0)
+	return r;
+    ret = (struct Nsreq_poll *) REQVA;
+    for (i = 0; i < nfds; i++)
+	fds[i].revents = ret->req_fds[i].revents;
+    return r;
+}
+
+int
+nsipc_epoll_create(void) {
+    int perm;
+
+    return nsipc(NSREQ_EPOLL_CREATE, nsipcbuf, 0, &perm);
+}
+
+int
+nsipc_epoll_ctl(int ep, int op, int s, struct epoll_event *event) {
+    int perm;
+    struct Nsreq_epoll_ctl *req;
+
+    req = (struct Nsreq_epoll_ctl*)nsipcbuf;
+    req->req_ep = ep;
+    req->req_op = op;
+    req->req_s = s;
+    if (event)
+	req->req_event = *event;
+    else
+	memset(&req->req_event, 0, sizeof(req->req_event));
+    return nsipc(NSREQ_EPOLL_CTL, req, 0, &perm);
+}
+
+// All ready sockets of interest set 'ep' come back in one reply, up to
+// 'maxevents' of them.
+int
+nsipc_epoll_wait(int ep, struct epoll_event *events, int maxevents,
+		 int timeout) {
+    int perm, r;
+    struct Nsreq_epoll_wait *req;
+
+    if (maxevents <= 0)
+	return -E_INVAL;
+    req = (struct Nsreq_epoll_wait*)nsipcbuf;
+    req->req_ep = ep;
+    req->req_maxevents = MIN(maxevents, (int) NSMAXEVENTS);
+    req->req_timeout = timeout;
+
+    if ((r = nsipc(NSREQ_EPOLL_WAIT, req, (void *)REQVA, &perm)) > 0)
+	memmove(events, (void *)REQVA, r * sizeof(events[0]));
+    return r;
+}
+
+int
+nsipc_epoll_close(int ep) {
+    int perm;
+    struct Nsreq_epoll_close *req;
+
+    req = (struct Nsreq_epoll_close*)nsipcbuf;
+    req->req_ep = ep;
+    return nsipc(NSREQ_EPOLL_CLOSE, req, 0, &perm);
+}
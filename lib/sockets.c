@@ -1,6 +1,132 @@
 #include <inc/lib.h>
+#include <inc/ns.h>
+#include <inc/x86.h>
 #include <lwip/sockets.h>
 
+// Where the rings of socket s are mapped, if it has them; see sockring
+#define RINGBASE	(0xD0000000 - 2 * PTSIZE)
+#define RING(s)		((struct Nsring *) (RINGBASE + (s) * NSRING_NPAGES * PGSIZE))
+
+static bool ringed[NSMAXRINGS];
+
+static struct Nsring *
+ring_lookup(int s) {
+    if (s < 0 || s >= NSMAXRINGS || !ringed[s])
+	return 0;
+    return RING(s);
+}
+
+// Give TCP socket 's' send and receive rings shared with the network
+// server.  From then on recv and send only copy to or from them, and go
+// to the server just to wait for data or room, or to wake it up.
+int
+sockring(int s) {
+    int i, r;
+    struct Nsring *ring;
+
+    if (s < 0 || s >= NSMAXRINGS)
+	return -E_INVAL;
+    if (ringed[s])
+	return 0;
+
+    ring = RING(s);
+    for (i = 0; i < NSRING_NPAGES; i++)
+	if ((r = sys_page_alloc(0, (char *) ring + i * PGSIZE,
+				PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
+	    goto fail;
+    if ((r = nsipc_ring(s, ring)) < 0)
+	goto fail;
+    ringed[s] = 1;
+    return 0;
+
+ fail:
+    for (i = 0; i < NSRING_NPAGES; i++)
+	sys_page_unmap(0, (char *) ring + i * PGSIZE);
+    return r;
+}
+
+// Take what has come in, up to 'len' bytes, waiting for something unless
+// MSG_DONTWAIT.  Returns 0 at the end of the stream, like lwip_recv.
+static int
+ring_recv(int s, struct Nsring *ring, char *mem, int len, unsigned int flags) {
+    uint32_t cons, ev;
+    int n, off, r;
+
+    cons = ring->sr_rxcons;
+    for (;;) {
+	ev = ring->sr_events;
+	if ((n = ring->sr_rxprod - cons) > 0)
+	    break;
+	if (ring->sr_rxeof)
+	    return 0;
+	if (flags & MSG_DONTWAIT)
+	    return -1;
+	if ((r = nsipc_ringwait(s, ev)) < 0)
+	    return r;
+    }
+
+    n = MIN(n, len);
+    off = cons % NSRING_SIZE;
+    if (off + n <= NSRING_SIZE)
+	memmove(mem, NSRING_RXDATA(ring) + off, n);
+    else {
+	memmove(mem, NSRING_RXDATA(ring) + off, NSRING_SIZE - off);
+	memmove(mem + NSRING_SIZE - off, NSRING_RXDATA(ring),
+		n - (NSRING_SIZE - off));
+    }
+    if (flags & MSG_PEEK)
+	return n;
+
+    // The locked exchange orders the store before the load of sr_rxfull
+    xchg(&ring->sr_rxcons, cons + n);
+    if (ring->sr_rxfull)
+	nsipc_ringkick();
+    return n;
+}
+
+// Put all 'size' bytes in the send ring, waiting for room as needed.
+static int
+ring_send(int s, struct Nsring *ring, const char *data, int size) {
+    uint32_t prod, ev;
+    int n, tot, off, r;
+
+    prod = ring->sr_txprod;
+    for (tot = 0; tot < size; tot += n) {
+	ev = ring->sr_events;
+	if (ring->sr_txerr)
+	    return tot ? tot : ring->sr_txerr;
+	if ((n = NSRING_SIZE - (prod - ring->sr_txcons)) == 0) {
+	    if ((r = nsipc_ringwait(s, ev)) < 0)
+		return tot ? tot : r;
+	    continue;
+	}
+
+	off = prod % NSRING_SIZE;
+	n = MIN(MIN(n, size - tot), NSRING_SIZE - off);
+	memmove(NSRING_TXDATA(ring) + off, data + tot, n);
+	prod += n;
+	xchg(&ring->sr_txprod, prod);
+	if (ring->sr_txidle)
+	    nsipc_ringkick();
+    }
+    return tot;
+}
+
+// Wait for what is in the send ring to have gone out, before anything
+// is sent or done on the socket outside the ring.
+static void
+ring_flush(int s, struct Nsring *ring) {
+    uint32_t ev;
+
+    for (;;) {
+	ev = ring->sr_events;
+	if (ring->sr_txcons == ring->sr_txprod || ring->sr_txerr)
+	    return;
+	if (nsipc_ringwait(s, ev) < 0)
+	    return;
+    }
+}
+
 int
 accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
     return nsipc_accept(s, addr, addrlen);
@@ -18,7 +144,17 @@ shutdown(int s, int how) {
 
 int
 closesocket(int s) {
-    return nsipc_close(s);
+    int i, r;
+    struct Nsring *ring;
+
+    if (!(ring = ring_lookup(s)))
+	return nsipc_close(s);
+    ring_flush(s, ring);
+    r = nsipc_close(s);
+    ringed[s] = 0;
+    for (i = 0; i < NSRING_NPAGES; i++)
+	sys_page_unmap(0, (char *) ring + i * PGSIZE);
+    return r;
 }
 
 int
@@ -33,12 +169,31 @@ listen(int s, int backlog) {
 
 int
 recv(int s, void *mem, int len, unsigned int flags) {
+    struct Nsring *ring;
+
+    if ((ring = ring_lookup(s)))
+	return ring_recv(s, ring, mem, len, flags);
     return nsipc_recv(s, mem, len, flags);
 }
 
+// Large sends go to the server NSMAXSENDPAGES pages at a time, without
+// copying; see nsipc_send.
 int
 send(int s, const void *dataptr, int size, unsigned int flags) {
-    return nsipc_send(s, dataptr, size, flags);
+    int r, tot;
+    struct Nsring *ring;
+
+    if ((ring = ring_lookup(s)))
+	return ring_send(s, ring, dataptr, size);
+
+    tot = 0;
+    do {
+	if ((r = nsipc_send(s, (const char *) dataptr + tot, size - tot,
+			    flags)) < 0)
+	    return tot ? tot : r;
+	tot += r;
+    } while (tot < size && r > 0);
+    return tot;
 }
 
 int
@@ -46,3 +201,101 @@ socket(int domain, int type, int protocol) {
     return nsipc_socket(domain, type, protocol);
 }
 
+// Send 'len' bytes of the file open as 'fd', starting at 'offset', on
+// socket 's' without copying them; see nsipc_sendfile.
+// Returns the number of bytes sent, which is short at the end of the file.
+int
+sendfile(int s, int fd, off_t offset, size_t len) {
+    struct Stat st;
+    int r, n, tot;
+    struct Nsring *ring;
+
+    if ((r = fstat(fd, &st)) < 0)
+	return r;
+    if ((ring = ring_lookup(s)))
+	ring_flush(s, ring);
+    if (offset >= st.st_size)
+	return 0;
+    len = MIN(len, st.st_size - offset);
+    for (tot = 0; tot < len; tot += n) {
+	n = MIN(len - tot, NSMAXSENDPAGES * PGSIZE - (offset + tot) % PGSIZE);
+	if ((r = nsipc_sendfile(s, fd, offset + tot, n)) < 0)
+	    return tot ? tot : r;
+    }
+    return tot;
+}
+
+int
+poll(struct pollfd *fds, int nfds, int timeout) {
+    return nsipc_poll(fds, nfds, timeout);
+}
+
+// On top of poll.  exceptset gets the sockets with errors.
+int
+select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+       struct timeval *timeout) {
+    struct pollfd fds[NSMAXSOCKETS];
+    int i, n, r, ms;
+
+    if (maxfdp1 < 0 || maxfdp1 > NSMAXSOCKETS)
+	return -E_INVAL;
+
+    for (n = i = 0; i < maxfdp1; i++) {
+	fds[n].fd = i;
+	fds[n].events = 0;
+	if (readset && FD_ISSET(i, readset))
+	    fds[n].events |= POLLIN;
+	if (writeset && FD_ISSET(i, writeset))
+	    fds[n].events |= POLLOUT;
+	if (fds[n].events || (exceptset && FD_ISSET(i, exceptset)))
+	    n++;
+    }
+    ms = timeout ? timeout->tv_sec * 1000 + timeout->tv_usec / 1000 : -1;
+    if ((r = nsipc_poll(fds, n, ms)) < 0)
+	return r;
+
+    if (readset)
+	FD_ZERO(readset);
+    if (writeset)
+	FD_ZERO(writeset);
+    if (exceptset)
+	FD_ZERO(exceptset);
+    for (r = i = 0; i < n; i++) {
+	if (readset && (fds[i].revents & (POLLIN|POLLHUP))
+	    && (fds[i].events & POLLIN)) {
+	    FD_SET(fds[i].fd, readset);
+	    r++;
+	}
+	if (writeset && (fds[i].revents & POLLOUT)) {
+	    FD_SET(fds[i].fd, writeset);
+	    r++;
+	}
+	if (exceptset && (fds[i].revents & (POLLERR|POLLNVAL))) {
+	    FD_SET(fds[i].fd, exceptset);
+	    r++;
+	}
+    }
+    return r;
+}
+
+// An interest set is kept by the network server; 'size' is only a hint,
+// as on Unix.
+int
+epoll_create(int size) {
+    return nsipc_epoll_create();
+}
+
+int
+epoll_ctl(int ep, int op, int s, struct epoll_event *event) {
+    return nsipc_epoll_ctl(ep, op, s, event);
+}
+
+int
+epoll_wait(int ep, struct epoll_event *events, int maxevents, int timeout) {
+    return nsipc_epoll_wait(ep, events, maxevents, timeout);
+}
+
+int
+epoll_close(int ep) {
+    return nsipc_epoll_close(ep);
+}
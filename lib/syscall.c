@@ -117,12 +117,51 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 0);
 }
 
+int
+sys_ipc_try_send_pages(envid_t envid, uint32_t value, uintptr_t *srcvas, int npages, int perm)
+{
+	return syscall(SYS_ipc_try_send_pages, 0, envid, value, (uint32_t) srcvas, npages, perm);
+}
+
 int
 sys_ipc_recv(void *dstva)
 {
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_recv_pages(void *dstva, int npages)
+{
+	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, npages, 0, 0, 0);
+}
+
+// Start receiving into dstva without blocking; see sys_ipc_wait.
+int
+sys_ipc_recv_nb(void *dstva)
+{
+	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 1, 0, 0);
+}
+
+int
+sys_ipc_recv_pages_nb(void *dstva, int npages)
+{
+	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, npages, 1, 0, 0);
+}
+
+int
+sys_ipc_wait(void)
+{
+	return syscall(SYS_ipc_wait, 0, ~0, 0, 0, 0, 0);
+}
+
+// Like sys_ipc_wait, but give up when the clock reaches msec and, with
+// 'nic' set, wake up as well when the NIC receives a frame.
+int
+sys_ipc_wait_until(uint32_t msec, bool nic)
+{
+	return syscall(SYS_ipc_wait, 0, msec, nic, 0, 0, 0);
+}
+
 unsigned
 sys_time_msec()
 {
@@ -135,8 +174,88 @@ sys_nic_send(char *packet, int size)
 	return syscall(SYS_nic_send, 0, (uint32_t)packet, (uint32_t)size, 0, 0, 0);
 }
 
+int
+sys_nic_send_sg(const struct nic_seg *segs, int nseg, struct nic_txstat *st)
+{
+	return syscall(SYS_nic_send_sg, 0, (uint32_t)segs, nseg, (uint32_t)st, 0, 0);
+}
+
+int
+sys_nic_send_batch(const struct nic_frame *frames, int nframes, struct nic_txstat *st)
+{
+	return syscall(SYS_nic_send_batch, 0, (uint32_t)frames, nframes, (uint32_t)st, 0, 0);
+}
+
+int
+sys_nic_stats(struct nic_stats *st)
+{
+	return syscall(SYS_nic_stats, 0, (uint32_t)st, 0, 0, 0, 0);
+}
+
 int
 sys_nic_recv(char *packet, int *size)
 {
 	return syscall(SYS_nic_recv, 0, (uint32_t)packet, (uint32_t )size, 0, 0, 0);
 }
+
+// Like sys_nic_recv, but sleep until a frame comes in if there is none.
+int
+sys_nic_recv_wait(char *packet, int *size)
+{
+	int r;
+
+	while ((r = syscall(SYS_nic_recv, 0, (uint32_t)packet, (uint32_t)size, 1, 0, 0)) == 1)
+		/* woken up by the receive interrupt */;
+	return r;
+}
+
+// Receive a frame by taking over the page the NIC put it in; the page is
+// mapped at va, with a struct jif_pkt NIC_PKTOFF bytes in.  Sleeps until
+// a frame comes in if there is none.
+int
+sys_nic_recv_page(void *va)
+{
+	int r;
+
+	while ((r = syscall(SYS_nic_recv_page, 0, (uint32_t)va, 1, 0, 0, 0)) == 1)
+		/* woken up by the receive interrupt */;
+	return r;
+}
+
+// Receive up to n frames as sys_nic_recv_page does, at va, va + PGSIZE
+// and so on, and return how many came.  Sleeps until a frame comes in if
+// there is none.
+int
+sys_nic_recv_pages(void *va, int n)
+{
+	int r;
+
+	while ((r = syscall(SYS_nic_recv_pages, 0, (uint32_t)va, n, 1, 0, 0)) == 0)
+		/* woken up by the receive interrupt */;
+	return r;
+}
+
+// Like sys_nic_recv_pages, but return 0 if there is no frame waiting.
+int
+sys_nic_recv_pages_nb(void *va, int n)
+{
+	return syscall(SYS_nic_recv_pages, 0, (uint32_t)va, n, 0, 0, 0);
+}
+
+int
+sys_nic_ring_map(void *va)
+{
+	return syscall(SYS_nic_ring_map, 0, (uint32_t)va, 0, 0, 0, 0);
+}
+
+int
+sys_nic_ring_sync(void)
+{
+	return syscall(SYS_nic_ring_sync, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_nic_wait(void)
+{
+	return syscall(SYS_nic_wait, 0, 0, 0, 0, 0, 0);
+}
@@ -116,6 +116,9 @@ struct lwip_setgetsockopt_data {
 static struct lwip_socket sockets[NUM_SOCKETS];
 /** The global list of tasks waiting for select */
 static struct lwip_select_cb *select_cb_list;
+/** JOS: bumped on every socket event, for threads that wait on
+    thread_wait instead of a semaphore; see lwip_sockstate */
+volatile u32_t lwip_sockevents;
 
 /** Semaphore protecting the sockets array */
 static sys_sem_t socksem;
@@ -634,6 +637,82 @@ lwip_send(int s, const void *data, int size, unsigned int flags)
   return (err==ERR_OK?size:-1);
 }
 
+/**
+ * JOS: like lwip_send on a TCP socket, but the data is queued by
+ * reference instead of being copied.  It has to stay in place until
+ * lwip_nocopy_done(nc) returns nonzero.
+ */
+int
+lwip_send_nocopy(int s, const void *data, int size, struct lwip_nocopy *nc)
+{
+  struct lwip_socket *sock;
+  err_t err;
+
+  nc->pcb = NULL;
+  sock = get_socket(s);
+  if (!sock)
+    return -1;
+
+  if (sock->conn->type!=NETCONN_TCP) {
+    sock_set_errno(sock, err_to_errno(ERR_ARG));
+    return -1;
+  }
+
+  err = netconn_write(sock->conn, data, size, NETCONN_NOCOPY);
+
+  /* Even a failed write may have queued part of the data */
+  if (sock->conn->pcb.tcp != NULL) {
+    nc->pcb = sock->conn->pcb.tcp;
+    nc->serial = sock->conn->pcb.tcp->serial;
+    nc->end = sock->conn->pcb.tcp->snd_lbb;
+  }
+  sock_set_errno(sock, err_to_errno(err));
+  return (err==ERR_OK?size:-1);
+}
+
+/**
+ * JOS: whether the data queued by lwip_send_nocopy is no longer
+ * referenced: it has all been acknowledged, or the connection has left
+ * the active state, which drops the segments it still held.  The
+ * socket may have been closed meanwhile and its pcb freed and reused, so
+ * the pcb is recognized by its serial number, not just its address.
+ */
+int
+lwip_nocopy_done(const struct lwip_nocopy *nc)
+{
+  struct tcp_pcb *p;
+
+  for (p = tcp_active_pcbs; p != NULL; p = p->next)
+    if (p == nc->pcb && p->serial == nc->serial)
+      return (p->unsent == NULL && p->unacked == NULL) ||
+        TCP_SEQ_GEQ(p->lastack, nc->end);
+  return 1;
+}
+
+/**
+ * JOS: what select would find for socket s right now, as LWIP_SOCK_*
+ * bits, or -1 if there is no such socket.  Waiting for a change is up
+ * to the caller: lwip_sockevents changes with every event.
+ */
+int
+lwip_sockstate(int s)
+{
+  struct lwip_socket *sock;
+  int state = 0;
+
+  sock = get_socket(s);
+  if (!sock)
+    return -1;
+
+  if (sock->lastdata || sock->rcvevent)
+    state |= LWIP_SOCK_READABLE;
+  if (sock->sendevent)
+    state |= LWIP_SOCK_WRITABLE;
+  if (ERR_IS_FATAL(sock->conn->err))
+    state |= LWIP_SOCK_ERROR;
+  return state;
+}
+
 int
 lwip_sendto(int s, const void *data, int size, unsigned int flags,
        struct sockaddr *to, socklen_t tolen)
@@ -1029,6 +1108,7 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
   }
 
   sys_sem_wait(selectsem);
+  lwip_sockevents++;
   /* Set event as required */
   switch (evt) {
     case NETCONN_EVT_RCVPLUS:
@@ -74,6 +74,8 @@ struct tcp_pcb *tcp_tw_pcbs;
 struct tcp_pcb *tcp_tmp_pcb;
 
 static u8_t tcp_timer;
+/* JOS: serial number of the last pcb allocated */
+static u32_t tcp_pcb_serial;
 static u16_t tcp_new_port(void);
 
 /**
@@ -1023,6 +1025,7 @@ tcp_alloc(u8_t prio)
 #endif /* LWIP_TCP_KEEPALIVE */
 
     pcb->keep_cnt_sent = 0;
+    pcb->serial = ++tcp_pcb_serial;
   }
   return pcb;
 }
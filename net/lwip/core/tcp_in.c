@@ -71,6 +71,7 @@ static u8_t recv_flags;
 static struct pbuf *recv_data;
 
 struct tcp_pcb *tcp_input_pcb;
+volatile u32_t tcp_ackevents;
 
 /* Forward declarations. */
 static err_t tcp_process(struct tcp_pcb *pcb);
@@ -292,6 +293,10 @@ tcp_input(struct pbuf *p, struct netif *inp)
     tcp_input_pcb = pcb;
     err = tcp_process(pcb);
     tcp_input_pcb = NULL;
+    /* JOS: for threads waiting on sent data, see lwip_nocopy_done */
+    if (err == ERR_ABRT || (recv_flags & (TF_RESET | TF_CLOSED)) ||
+        pcb->acked > 0)
+      tcp_ackevents++;
     /* A return value of ERR_ABRT means that tcp_abort() was called
        and that the pcb has been freed. If so, we don't do anything. */
     if (err != ERR_ABRT) {
@@ -60,6 +60,8 @@ typedef enum {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** indicates this is a custom pbuf: pbuf_free calls its free function */
+#define PBUF_FLAG_IS_CUSTOM 0x02U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -95,10 +97,22 @@ struct pbuf {
   
 };
 
+/** A custom pbuf: like a PBUF_REF pbuf, but allocated and freed by its
+ * owner rather than from MEMP_PBUF. The pbuf must come first. */
+struct pbuf_custom {
+  /** the actual pbuf */
+  struct pbuf pbuf;
+  /** called instead of memp_free when the pbuf is freed */
+  void (*custom_free_function)(struct pbuf *p);
+};
+
 /* Initializes the pbuf module. This call is empty for now, but may not be in future. */
 #define pbuf_init()
 
 struct pbuf *pbuf_alloc(pbuf_layer l, u16_t size, pbuf_type type);
+struct pbuf *pbuf_alloced_custom(pbuf_layer l, u16_t length, pbuf_type type,
+                                 struct pbuf_custom *p, void *payload_mem,
+                                 u16_t payload_mem_len);
 void pbuf_realloc(struct pbuf *p, u16_t size); 
 u8_t pbuf_header(struct pbuf *p, s16_t header_size);
 void pbuf_ref(struct pbuf *p);
@@ -297,6 +297,20 @@ struct timeval {
 };
 #endif /* LWIP_TIMEVAL_PRIVATE */
 
+/* JOS: lwip_sockstate bits */
+#define LWIP_SOCK_READABLE  0x1
+#define LWIP_SOCK_WRITABLE  0x2
+#define LWIP_SOCK_ERROR     0x4
+
+extern volatile u32_t lwip_sockevents;
+
+/* JOS: where lwip_send_nocopy queued data, for lwip_nocopy_done */
+struct lwip_nocopy {
+  void *pcb;
+  u32_t serial;
+  u32_t end;
+};
+
 void lwip_socket_init(void);
 
 int lwip_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -314,6 +328,9 @@ int lwip_read(int s, void *mem, int len);
 int lwip_recvfrom(int s, void *mem, int len, unsigned int flags,
       struct sockaddr *from, socklen_t *fromlen);
 int lwip_send(int s, const void *dataptr, int size, unsigned int flags);
+int lwip_send_nocopy(int s, const void *dataptr, int size, struct lwip_nocopy *nc);
+int lwip_nocopy_done(const struct lwip_nocopy *nc);
+int lwip_sockstate(int s);
 int lwip_sendto(int s, const void *dataptr, int size, unsigned int flags,
     struct sockaddr *to, socklen_t tolen);
 int lwip_socket(int domain, int type, int protocol);
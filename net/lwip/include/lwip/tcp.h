@@ -343,6 +343,9 @@ struct tcp_pcb {
 
   struct pbuf *refused_data; /* Data previously received but not yet taken by upper layer */
 
+  /* JOS: tells this pcb from a later one allocated at the same address */
+  u32_t serial;
+
 #if LWIP_CALLBACK_API
   /* Function to be called when more send buffer space is available.
    * @param arg user-supplied argument (tcp_pcb.callback_arg)
@@ -538,6 +541,8 @@ u16_t tcp_eff_send_mss(u16_t sendmss, struct ip_addr *addr);
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
 
 extern struct tcp_pcb *tcp_input_pcb;
+/* JOS: bumped whenever a segment acknowledges data or ends a connection */
+extern volatile u32_t tcp_ackevents;
 extern u32_t tcp_ticks;
 
 #if TCP_DEBUG || TCP_INPUT_DEBUG || TCP_OUTPUT_DEBUG
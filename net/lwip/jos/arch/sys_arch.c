@@ -312,12 +312,24 @@ out:
     return &t->tmo;
 }
 
+static void (*core_unlock_hook)(void);
+
 void
 lwip_core_lock(void)
 {
 }
 
+// Have 'hook' called whenever a thread gives up the core, to push out
+// what the stack has batched up meanwhile.
+void
+lwip_core_set_unlock_hook(void (*hook)(void))
+{
+    core_unlock_hook = hook;
+}
+
 void
 lwip_core_unlock(void)
 {
+    if (core_unlock_hook)
+	core_unlock_hook();
 }
@@ -13,6 +13,7 @@ typedef int sys_thread_t;
 void lwip_core_lock(void);
 void lwip_core_unlock(void);
 void lwip_core_init(void);
+void lwip_core_set_unlock_hook(void (*hook)(void));
 
 #define SYS_ARCH_DECL_PROTECT(lev)
 #define SYS_ARCH_PROTECT(lev)
@@ -37,6 +37,9 @@ thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
     uint32_t p = s;
 
     cur_tc->tc_wait_addr = addr;
+    cur_tc->tc_wait_val = val;
+    cur_tc->tc_wait_msec = msec;
+    cur_tc->tc_waiting = 1;
     cur_tc->tc_wakeup = 0;
 
     while (p < msec) {
@@ -52,9 +55,28 @@ thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
     }
 
     cur_tc->tc_wait_addr = 0;
+    cur_tc->tc_waiting = 0;
     cur_tc->tc_wakeup = 0;
 }
 
+// If every other thread is in thread_wait with only time left to wake
+// it, returns the soonest msec one of them waits until ((uint32_t)~0
+// for none); otherwise 0.  The caller may then sleep the whole env until
+// that time, or until something from outside comes in.
+uint32_t
+thread_wait_deadline(void) {
+    struct thread_context *tc;
+    uint32_t msec = ~0;
+
+    for (tc = thread_queue.tq_first; tc; tc = tc->tc_queue_link) {
+	if (!tc->tc_waiting || tc->tc_wakeup ||
+	    (tc->tc_wait_addr && *tc->tc_wait_addr != tc->tc_wait_val))
+	    return 0;
+	msec = MIN(msec, tc->tc_wait_msec);
+    }
+    return msec;
+}
+
 int
 thread_onhalt(void (*fun)(void)) {
     if (cur_tc->tc_nonhalt >= THREAD_NUM_ONHALT)
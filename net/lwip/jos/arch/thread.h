@@ -9,6 +9,7 @@ void thread_init(void);
 thread_id_t thread_id(void);
 void thread_wakeup(volatile uint32_t *addr);
 void thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec);
+uint32_t thread_wait_deadline(void);
 int thread_onhalt(void (*fun)(void));
 int thread_create(thread_id_t *tid, const char *name, 
 		void (*entry)(uint32_t), uint32_t arg);
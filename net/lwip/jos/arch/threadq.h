@@ -24,6 +24,9 @@ struct thread_context {
     uint32_t		tc_arg;
     struct jos_jmp_buf	tc_jb;
     volatile uint32_t	*tc_wait_addr;
+    uint32_t		tc_wait_val;
+    uint32_t		tc_wait_msec;
+    char		tc_waiting;	/* in thread_wait */
     volatile char	tc_wakeup;
     void		(*tc_onhalt[THREAD_NUM_ONHALT])(void);
     int			tc_nonhalt;
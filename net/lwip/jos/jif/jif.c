@@ -43,17 +43,178 @@
 
 #include <netif/etharp.h>
 
-#define PKTMAP		0x10000000
+/* Received frames stay in the page the NIC put them in: each is mapped
+ * at a slot of its own here and handed to the stack as a custom pbuf.
+ * Once the stack is done with it the slot is free again; the page stays
+ * mapped until the next frame mapped there replaces it, which saves a
+ * trap per frame. */
+#define RXVA		0x10100000
+#define NRXPAGE		256
+
+struct rxpage {
+    struct pbuf_custom pc;
+    struct rxpage *next;	/* on the free list */
+};
+
+static struct rxpage rxpages[NRXPAGE];
+static struct rxpage *rxfree;
+
+static void *
+rxpage_va(struct rxpage *rp)
+{
+    return (void *)(RXVA + (rp - rxpages) * PGSIZE);
+}
+
+static void
+rxpage_free(struct pbuf *p)
+{
+    struct rxpage *rp = (struct rxpage *)p;
+
+    rp->next = rxfree;
+    rxfree = rp;
+}
+
+/* Frames go out without copying either: the NIC fetches the payload of
+ * each pbuf itself, so the pbufs are held here until it is done.  They
+ * go to the kernel in batches, a page of struct nic_frame at a time,
+ * once the batch fills up or the stack gives up the core (jif_flush). */
+#define NTXPEND		256
+
+static struct txpend {
+    struct pbuf *p;
+    u32_t queued;	/* tx_queued as of sending it */
+} txpend[NTXPEND];
+static int txhead, txcount;
+
+static struct nic_frame txbatch[NIC_MAXBATCH] __attribute__((aligned(PGSIZE)));
+static struct pbuf *txbatchp[NIC_MAXBATCH];
+static int ntxbatch;
+
+/* Frames in more pieces than the NIC takes are copied here */
+static char txbuf[1518];
+
+static void
+tx_reclaim(struct nic_txstat *st)
+{
+    while (txcount > 0 && (s32_t)(st->tx_done - txpend[txhead].queued) >= 0) {
+	pbuf_free(txpend[txhead].p);
+	txhead = (txhead + 1) % NTXPEND;
+	txcount--;
+    }
+}
+
+/* With NS_RING set the NIC rings are mapped here instead, and frames
+ * move through them without trapping: outgoing ones are copied into
+ * transmit slots, posted by jif_flush, and incoming ones copied out of
+ * the receive slots by jif_poll, whenever ns hears from the input env
+ * or the timer.  Both copies are cheaper than the traps they save. */
+#ifndef NS_RING
+#define NS_RING		0
+#endif
+#define RINGVA		(RXVA + NRXPAGE * PGSIZE)
+
+static struct nic_ring *ring = (struct nic_ring *)RINGVA;
+static u32_t txslot, rxslot;		/* next slots to fill and to read */
+static u32_t txsynced, rxsynced;	/* counts handed to the kernel */
+static struct netif *jifif;
+
+static void
+ring_sync(void)
+{
+    int r;
+
+    if (ring->nr_txprod == txsynced && ring->nr_rxcons == rxsynced)
+	return;
+    if ((r = sys_nic_ring_sync()) < 0)
+	panic("jif: ring sync: %e", r);
+    txsynced = ring->nr_txprod;
+    rxsynced = ring->nr_rxcons;
+}
+
+static err_t
+ring_output(struct netif *netif, struct pbuf *p)
+{
+    if (ring->nr_txprod - ring->nr_txcons == ring->nr_ntx)
+	ring_sync();	/* have the NIC get on with them, at least */
+    if (ring->nr_txprod - ring->nr_txcons == ring->nr_ntx ||
+	p->tot_len > NIC_RING_BUFSZ) {
+	LINK_STATS_INC(link.drop);
+	return ERR_OK;
+    }
+
+    pbuf_copy_partial(p, ring->nr_txbuf + txslot * NIC_RING_BUFSZ,
+		      p->tot_len, 0);
+    ring->nr_txlen[txslot] = p->tot_len;
+    txslot = (txslot + 1) % ring->nr_ntx;
+    ring->nr_txprod++;
+    return ERR_OK;
+}
+
+/* Send the frames batched up so far, with one trap */
+void
+jif_flush(void)
+{
+    struct nic_txstat st;
+    int i, n;
+
+    if (NS_RING) {
+	ring_sync();
+	return;
+    }
+    if (ntxbatch == 0)
+	return;
+    /* The kernel queues the first n, and drops the rest */
+    if ((n = sys_nic_send_batch(txbatch, ntxbatch, &st)) < 0)
+	n = 0;
+    for (i = 0; i < ntxbatch; i++) {
+	if (i < n) {
+	    txpend[(txhead + txcount) % NTXPEND].p = txbatchp[i];
+	    txpend[(txhead + txcount) % NTXPEND].queued = st.tx_queued - (n - 1 - i);
+	    txcount++;
+	} else {
+	    LINK_STATS_INC(link.drop);
+	    pbuf_free(txbatchp[i]);
+	}
+    }
+    ntxbatch = 0;
+    tx_reclaim(&st);
+}
+
+/* Called periodically, to let go of the pbufs of frames sent meanwhile */
+void
+jif_tmr(void)
+{
+    struct nic_txstat st;
+
+    if (NS_RING) {
+	jif_poll(jifif);
+	jif_flush();
+	return;
+    }
+    jif_flush();
+    if (txcount > 0 && sys_nic_send_sg(0, 0, &st) == 0)
+	tx_reclaim(&st);
+}
 
 struct jif {
     struct eth_addr *ethaddr;
-    envid_t envid;
 };
 
 static void
 low_level_init(struct netif *netif)
 {
-    int r;
+    int i, r;
+
+    if (NS_RING) {
+	if ((r = sys_nic_ring_map(ring)) < 0)
+	    panic("jif: cannot map the NIC rings: %e", r);
+	rxslot = ring->nr_rxfirst;
+    }
+
+    for (i = NRXPAGE - 1; i >= 0; i--) {
+	rxpages[i].next = rxfree;
+	rxfree = &rxpages[i];
+    }
 
     netif->hwaddr_len = 6;
     netif->mtu = 1500;
@@ -79,56 +240,56 @@ low_level_init(struct netif *netif)
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
-    int r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
-    if (r < 0)
-	panic("jif: could not allocate page of memory");
-    struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
-
-    struct jif *jif;
-    jif = netif->state;
-
-    char *txbuf = pkt->jp_data;
-    int txsize = 0;
+    struct nic_frame *f;
     struct pbuf *q;
-    for (q = p; q != NULL; q = q->next) {
-	/* Send the data from the pbuf to the interface, one pbuf at a
-	   time. The size of the data in each pbuf is kept in the ->len
-	   variable. */
-
-	if (txsize + q->len > 2000)
-	    panic("oversized packet, fragment %d txsize %d\n", q->len, txsize);
-	memcpy(&txbuf[txsize], q->payload, q->len);
-	txsize += q->len;
+    int n;
+
+    if (txcount + ntxbatch == NTXPEND)
+	jif_tmr();
+    if (txcount + ntxbatch == NTXPEND) {
+	LINK_STATS_INC(link.drop);
+	return ERR_OK;
     }
 
-    pkt->jp_len = txsize;
+    f = &txbatch[ntxbatch];
+    n = 0;
+    for (q = p; q != NULL && n < NIC_MAXSEGS; q = q->next) {
+	if (q->len == 0)
+	    continue;
+	f->nf_seg[n].ns_va = q->payload;
+	f->nf_seg[n].ns_len = q->len;
+	n++;
+    }
 
-    ipc_send(jif->envid, NSREQ_OUTPUT, (void *)pkt, PTE_P|PTE_W|PTE_U);
-    sys_page_unmap(0, (void *)pkt);
+    if (q != NULL) {
+	/* Too many pieces: send a copy, after the frames before it */
+	if (p->tot_len > sizeof(txbuf))
+	    panic("oversized packet, txsize %d\n", p->tot_len);
+	jif_flush();
+	pbuf_copy_partial(p, txbuf, p->tot_len, 0);
+	/* Simply drop the packet if fails */
+	sys_nic_send(txbuf, p->tot_len);
+	return ERR_OK;
+    }
 
+    f->nf_nseg = n;
+    pbuf_ref(p);
+    txbatchp[ntxbatch++] = p;
+    if (ntxbatch == NIC_MAXBATCH)
+	jif_flush();
     return ERR_OK;
 }
 
-/*
- * low_level_input():
- *
- * Should allocate a pbuf and transfer the bytes of the incoming
- * packet from the interface into the pbuf.
- *
- */
+/* Copy a received frame into pool pbufs */
 static struct pbuf *
-low_level_input(void *va)
+pool_copy(const char *rxbuf, int len)
 {
-    struct jif_pkt *pkt = (struct jif_pkt *)va;
-    s16_t len = pkt->jp_len;
-
     struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
     if (p == 0)
 	return 0;
 
     /* We iterate over the pbuf chain until we have read the entire
      * packet into the pbuf. */
-    void *rxbuf = (void *) pkt->jp_data;
     int copied = 0;
     struct pbuf *q;
     for (q = p; q != NULL; q = q->next) {
@@ -144,6 +305,38 @@ low_level_input(void *va)
 
     return p;
 }
+
+/*
+ * low_level_input():
+ *
+ * Should allocate a pbuf and transfer the bytes of the incoming
+ * packet from the interface into the pbuf.
+ *
+ */
+static struct pbuf *
+low_level_input(void *va)
+{
+    struct jif_pkt *pkt = (struct jif_pkt *)(va + NIC_PKTOFF);
+    s16_t len = pkt->jp_len;
+    struct rxpage *rp;
+    void *rxva;
+
+    if (len <= 0 || len > PGSIZE - NIC_PKTOFF - (int)sizeof(pkt->jp_len))
+	return 0;
+
+    /* Take the page over rather than copy out of it */
+    if ((rp = rxfree) != NULL &&
+	sys_page_map(0, va, 0, (rxva = rxpage_va(rp)), PTE_U|PTE_P|PTE_W) == 0) {
+	rxfree = rp->next;
+	rp->pc.custom_free_function = rxpage_free;
+	return pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &rp->pc,
+				   rxva + NIC_PKTOFF + sizeof(pkt->jp_len),
+				   len);
+    }
+
+    /* Out of slots: copy the frame into pool pbufs */
+    return pool_copy(pkt->jp_data, len);
+}
 /*
  * jif_output():
  *
@@ -171,20 +364,14 @@ jif_output(struct netif *netif, struct pbuf *p,
  *
  */
 
-void
-jif_input(struct netif *netif, void *va)
+static void
+eth_input(struct netif *netif, struct pbuf *p)
 {
     struct jif *jif;
     struct eth_hdr *ethhdr;
-    struct pbuf *p;
 
     jif = netif->state;
-  
-    /* move received packet into a new pbuf */
-    p = low_level_input(va);
 
-    /* no packet could be read, silently ignore this */
-    if (p == NULL) return;
     /* points to packet payload, which starts with an Ethernet header */
     ethhdr = p->payload;
 
@@ -208,6 +395,53 @@ jif_input(struct netif *netif, void *va)
     }
 }
 
+void
+jif_input(struct netif *netif, void *va)
+{
+    struct pbuf *p;
+
+    /* move received packet into a new pbuf */
+    p = low_level_input(va);
+
+    /* no packet could be read, silently ignore this */
+    if (p == NULL) return;
+    eth_input(netif, p);
+}
+
+/*
+ * jif_poll():
+ *
+ * With NS_RING, hand the stack the frames waiting in the receive slots.
+ *
+ */
+
+void
+jif_poll(struct netif *netif)
+{
+    struct pbuf *p;
+    char *slot;
+    int len;
+
+    for (;;) {
+	/* The kernel has yet to take back the slots read since the last
+	 * sync; do not go round onto them */
+	if (ring->nr_rxcons - rxsynced == ring->nr_nrx)
+	    ring_sync();
+	slot = ring->nr_rxbuf + rxslot * PGSIZE;
+	if ((len = nic_ring_rxlen(slot)) < 0)
+	    break;
+
+	p = pool_copy(NIC_RING_RXDATA(slot), len);
+	rxslot = (rxslot + 1) % ring->nr_nrx;
+	ring->nr_rxcons++;
+
+	if (p != NULL)
+	    eth_input(netif, p);
+	else
+	    LINK_STATS_INC(link.memerr);
+    }
+}
+
 /*
  * jif_init():
  *
@@ -221,7 +455,6 @@ err_t
 jif_init(struct netif *netif)
 {
     struct jif *jif;
-    envid_t *output_envid; 
 
     jif = mem_malloc(sizeof(struct jif));
 
@@ -230,17 +463,16 @@ jif_init(struct netif *netif)
 	return ERR_MEM;
     }
 
-    output_envid = (envid_t *)netif->state;
-
     netif->state = jif;
     netif->output = jif_output;
-    netif->linkoutput = low_level_output;
+    netif->linkoutput = NS_RING ? ring_output : low_level_output;
     memcpy(&netif->name[0], "en", 2);
 
     jif->ethaddr = (struct eth_addr *)&(netif->hwaddr[0]);
-    jif->envid = *output_envid; 
 
+    jifif = netif;
     low_level_init(netif);
+    lwip_core_set_unlock_hook(jif_flush);
 
     etharp_init();
 
@@ -2,3 +2,8 @@
 
 void	jif_input(struct netif *netif, void *va);
 err_t	jif_init(struct netif *netif);
+void	jif_tmr(void);
+void	jif_flush(void);
+void	jif_poll(struct netif *netif);
+
+#define JIF_TMR_INTERVAL	100	/* msec between jif_tmr calls */
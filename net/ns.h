@@ -7,9 +7,32 @@
 
 #define TIMER_INTERVAL 250
 
+// Build options; see conf/env.mk
+#ifndef NS_RING
+#define NS_RING		0
+#endif
+#ifndef NS_SINGLE
+#define NS_SINGLE	0
+#endif
+
+// The windows below are filled by IPC and the NIC, which replace whatever
+// is mapped there.  They lie above malloc's arena, which ends at
+// 0x10000000, and above jif's RXVA and RINGVA, so that no malloc'd thread
+// stack can be handed a page in them.
+#define NSWINVA		0x10800000
+
 // Virtual address at which to receive page mappings containing client requests.
+// Each request gets room for the request page and NSMAXSENDPAGES of data.
 #define QUEUE_SIZE	20
-#define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
+#define SLOTPAGES	(1 + NSMAXSENDPAGES)
+#define REQVA		NSWINVA
+
+// Where ns takes frames off the NIC itself, with NS_SINGLE
+#define INPUTVA		(REQVA + QUEUE_SIZE * SLOTPAGES * PGSIZE)
+
+// Where the rings of socket s are mapped, if its app shared them
+#define SOCKRINGVA	(INPUTVA + NSMAXSENDPAGES * PGSIZE)
+#define RINGVA(s)	(SOCKRINGVA + (s) * NSRING_NPAGES * PGSIZE)
 
 /* timer.c */
 void timer(envid_t ns_envid, uint32_t initial_to);
@@ -17,6 +40,3 @@ void timer(envid_t ns_envid, uint32_t initial_to);
 /* input.c */
 void input(envid_t ns_envid);
 
-/* output.c */
-void output(envid_t ns_envid);
-
@@ -39,12 +39,22 @@ struct timer_thread {
 static struct timer_thread t_arp;
 static struct timer_thread t_tcpf;
 static struct timer_thread t_tcps;
+static struct timer_thread t_jif;
 
 static envid_t timer_envid;
 static envid_t input_envid;
-static envid_t output_envid;
+
+// Sockets whose app shares rings with us; see struct Nsring
+static struct sockring {
+    struct Nsring *sr_ring;	// 0 if the socket has none
+    envid_t sr_waiter;		// in NSREQ_RINGWAIT, to reply to on a change
+    bool sr_closing;
+    bool sr_rxbusy;		// in ring_rx, which may yield in lwIP
+    bool sr_txbusy;		// ring_tx thread still running
+} rings[NSMAXRINGS];
 
 static bool buse[QUEUE_SIZE];
+static int bpages[QUEUE_SIZE];	// pages the request in each slot came with
 static int next_i(int i) { return (i+1) % QUEUE_SIZE; }
 static int prev_i(int i) { return (i ? i-1 : QUEUE_SIZE-1); }
 
@@ -61,16 +71,20 @@ get_buffer() {
 	return 0;
     }
 
-    va = (void *)(REQVA + i * PGSIZE);
+    va = (void *)(REQVA + i * SLOTPAGES * PGSIZE);
     buse[i] = 1;
     
     return va;
 }
 
+static int
+buffer_index(void *va) {
+    return ((uint32_t)va - REQVA) / (SLOTPAGES * PGSIZE);
+}
+
 static void
 put_buffer(void *va) {
-    int i = ((uint32_t)va - REQVA) / PGSIZE;
-    buse[i] = 0;
+    buse[buffer_index(va)] = 0;
 }
 
 static void
@@ -139,11 +153,12 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
     thread_wait(&done, 0, (uint32_t)~0);
     lwip_core_lock();
 
-    lwip_init(&nif, &output_envid, ipaddr, netmask, gw);
+    lwip_init(&nif, 0, ipaddr, netmask, gw);
 
     start_timer(&t_arp, &etharp_tmr, "arp timer", ARP_TMR_INTERVAL);
     start_timer(&t_tcpf, &tcp_fasttmr, "tcp f timer", TCP_FAST_INTERVAL);
     start_timer(&t_tcps, &tcp_slowtmr, "tcp s timer", TCP_SLOW_INTERVAL);
+    start_timer(&t_jif, &jif_tmr, "jif timer", JIF_TMR_INTERVAL);
 
     cprintf("NS: %02x:%02x:%02x:%02x:%02x:%02x" 
 	    " bound to static %d(%d)\n", 
@@ -187,9 +202,429 @@ serve_shutdown(envid_t envid, struct Nsreq_shutdown* rq) {
     ipc_send(envid, r, 0, 0);
 }
 
+// The data of a request that lent the pages it is in after the request
+// page, or 0 if the request's offset, size and page count don't add up,
+// or it claims more pages than the IPC delivered.
+static char *
+lent_data(void *rq, int offset, int size, int npages) {
+    if (npages < 1 || npages > NSMAXSENDPAGES || offset < 0
+	|| offset >= PGSIZE || size < 0 || offset + size > npages * PGSIZE
+	|| 1 + npages > bpages[buffer_index(rq)])
+	return 0;
+    return (char *)rq + PGSIZE + offset;
+}
+
+static void
+unmap_lent(void *rq) {
+    int i;
+
+    for (i = 0; i < NSMAXSENDPAGES; i++)
+	sys_page_unmap(0, (char *)rq + (1 + i) * PGSIZE);
+}
+
+// Tell the app the ring has changed, if it waits.
+static void
+ring_notify(struct sockring *sr) {
+    envid_t w;
+
+    sr->sr_ring->sr_events++;
+    lwip_sockevents++;	// readiness changes with the ring; see sock_poll
+    if ((w = sr->sr_waiter)) {
+	sr->sr_waiter = 0;
+	ipc_send(w, 0, 0, 0);
+    }
+}
+
+// Move what lwIP has for socket s into its receive ring, without waiting
+// for more.  If the ring fills up, the app kicks us once it has made room.
+static void
+ring_rx(int s) {
+    struct sockring *sr = &rings[s];
+    struct Nsring *ring = sr->sr_ring;
+    uint32_t prod;
+    int n, off;
+    bool moved = 0;
+
+    if (sr->sr_rxbusy || ring->sr_rxeof)
+	return;
+    sr->sr_rxbusy = 1;
+    ring->sr_rxfull = 0;
+    prod = ring->sr_rxprod;
+    for (;;) {
+	if (prod - ring->sr_rxcons == NSRING_SIZE) {
+	    // The locked exchange orders the store before the load of sr_rxcons
+	    xchg(&ring->sr_rxfull, 1);
+	    if (prod - ring->sr_rxcons == NSRING_SIZE)
+		break;
+	    ring->sr_rxfull = 0;
+	}
+	off = prod % NSRING_SIZE;
+	n = lwip_recv(s, NSRING_RXDATA(ring) + off,
+		      MIN(NSRING_SIZE - (prod - ring->sr_rxcons),
+			  NSRING_SIZE - off), MSG_DONTWAIT);
+	if (n < 0)
+	    break;
+	moved = 1;
+	if (n == 0) {
+	    ring->sr_rxeof = 1;
+	    break;
+	}
+	prod += n;
+	ring->sr_rxprod = prod;
+    }
+    sr->sr_rxbusy = 0;
+    if (moved)
+	ring_notify(sr);
+}
+
+// Called whenever lwIP may have taken in data, or an app made room.
+static void
+rings_poll(void) {
+    int s;
+
+    for (s = 0; s < NSMAXRINGS; s++)
+	if (rings[s].sr_ring && !rings[s].sr_closing)
+	    ring_rx(s);
+}
+
+// Sends what the app puts in socket s's send ring, for as long as the
+// ring is there.  Waits for the app in thread_wait, which it kicks out
+// of when it finds sr_txidle set.
+static void
+ring_tx(uint32_t arg) {
+    int s = arg;
+    struct sockring *sr = &rings[s];
+    struct Nsring *ring = sr->sr_ring;
+    uint32_t cons;
+    int n, off;
+
+    while (!sr->sr_closing) {
+	cons = ring->sr_txcons;
+	if (ring->sr_txprod == cons) {
+	    // Ordered against the app's store of sr_txprod, as in ring_rx
+	    xchg(&ring->sr_txidle, 1);
+	    if (ring->sr_txprod == cons)
+		thread_wait(&ring->sr_txprod, cons, (uint32_t) ~0);
+	    ring->sr_txidle = 0;
+	    continue;
+	}
+
+	off = cons % NSRING_SIZE;
+	n = MIN(ring->sr_txprod - cons, NSRING_SIZE - off);
+	if ((n = lwip_send(s, NSRING_TXDATA(ring) + off, n, 0)) < 0) {
+	    perror("ring_tx");
+	    ring->sr_txerr = n;
+	    ring_notify(sr);
+	    break;
+	}
+	ring->sr_txcons = cons + n;
+	ring_notify(sr);
+    }
+    sr->sr_txbusy = 0;
+}
+
+static void
+ring_unmap(int s) {
+    int i;
+
+    for (i = 0; i < NSRING_NPAGES; i++)
+	sys_page_unmap(0, (void *) (RINGVA(s) + i * PGSIZE));
+}
+
+// Map the lent pages as socket s's rings and start moving data through
+// them.  Only TCP sockets: the rings don't keep datagrams apart.
+static void
+serve_ring(envid_t envid, struct Nsreq_ring *rq) {
+    int r, i, s, type;
+    socklen_t len = sizeof(type);
+    struct sockring *sr;
+
+    s = rq->req_s;
+    if (s < 0 || s >= NSMAXRINGS || rings[s].sr_ring) {
+	r = -E_INVAL;
+	goto out;
+    }
+    if ((r = lwip_getsockopt(s, SOL_SOCKET, SO_TYPE, &type, &len)) < 0) {
+	perror("serve_ring");
+	goto out;
+    }
+    if (type != SOCK_STREAM) {
+	r = -E_INVAL;
+	goto out;
+    }
+
+    for (i = 0; i < NSRING_NPAGES; i++)
+	if ((r = sys_page_map(0, (char *)rq + (1 + i) * PGSIZE,
+			      0, (void *) (RINGVA(s) + i * PGSIZE),
+			      PTE_P|PTE_W|PTE_U)) < 0) {
+	    ring_unmap(s);
+	    goto out;
+	}
+
+    sr = &rings[s];
+    memset(sr, 0, sizeof(*sr));
+    sr->sr_ring = (struct Nsring *) RINGVA(s);
+    sr->sr_txbusy = 1;
+    if ((r = thread_create(0, "ring tx", ring_tx, s)) < 0) {
+	sr->sr_ring = 0;
+	ring_unmap(s);
+	goto out;
+    }
+    ring_rx(s);
+
+ out:
+    unmap_lent(rq);
+    ipc_send(envid, r, 0, 0);
+}
+
+static void
+serve_ringwait(envid_t envid, struct Nsreq_ringwait *rq) {
+    struct sockring *sr;
+    envid_t w;
+    int s = rq->req_s;
+
+    if (s < 0 || s >= NSMAXRINGS || !rings[s].sr_ring || rings[s].sr_closing) {
+	ipc_send(envid, -E_INVAL, 0, 0);
+	return;
+    }
+    sr = &rings[s];
+    if (sr->sr_ring->sr_events != rq->req_events) {
+	ipc_send(envid, 0, 0, 0);
+	return;
+    }
+    // One waiter a ring; one it replaces just looks again
+    if ((w = sr->sr_waiter))
+	ipc_send(w, 0, 0, 0);
+    sr->sr_waiter = envid;
+}
+
+// Stop using socket s's rings, once ring_rx and ring_tx are out of lwIP.
+static void
+ring_free(int s) {
+    struct sockring *sr = &rings[s];
+
+    sr->sr_closing = 1;
+    thread_wakeup(&sr->sr_ring->sr_txprod);
+    while (sr->sr_txbusy || sr->sr_rxbusy)
+	thread_yield();
+    if (sr->sr_waiter)
+	ipc_send(sr->sr_waiter, -E_INVAL, 0, 0);
+    ring_unmap(s);
+    memset(sr, 0, sizeof(*sr));
+}
+
+// What of POLLIN, POLLOUT, POLLERR and POLLHUP holds for socket s now.
+// A socket with rings is ready by its rings, which ns keeps up to date
+// with lwIP.
+static int
+sock_poll(int s) {
+    struct Nsring *ring;
+    int state, r = 0;
+
+    if ((state = lwip_sockstate(s)) < 0)
+	return POLLNVAL;
+    if (s < NSMAXRINGS && rings[s].sr_ring && !rings[s].sr_closing) {
+	ring = rings[s].sr_ring;
+	if (ring->sr_rxprod != ring->sr_rxcons || ring->sr_rxeof)
+	    r |= POLLIN;
+	if (ring->sr_txerr)
+	    r |= POLLERR;
+	else if (ring->sr_txprod - ring->sr_txcons < NSRING_SIZE)
+	    r |= POLLOUT;
+	if (ring->sr_rxeof && ring->sr_rxprod == ring->sr_rxcons)
+	    r |= POLLHUP;
+	return r;
+    }
+    if (state & LWIP_SOCK_READABLE)
+	r |= POLLIN;
+    if (state & LWIP_SOCK_WRITABLE)
+	r |= POLLOUT;
+    if (state & LWIP_SOCK_ERROR)
+	r |= POLLERR;
+    return r;
+}
+
+// When a wait of 'timeout' msec from now ends; < 0 is never
+static uint32_t
+poll_deadline(int timeout) {
+    if (timeout < 0)
+	return ~0;
+    return sys_time_msec() + timeout;
+}
+
+static void
+serve_poll(envid_t envid, struct Nsreq_poll *rq) {
+    struct pollfd *pfd;
+    uint32_t ev, until;
+    int i, n;
+
+    if (rq->req_nfds < 0 || rq->req_nfds > NSMAXSOCKETS) {
+	ipc_send(envid, -E_INVAL, 0, 0);
+	return;
+    }
+
+    until = poll_deadline(rq->req_timeout);
+    for (;;) {
+	ev = lwip_sockevents;
+	for (n = i = 0; i < rq->req_nfds; i++) {
+	    pfd = &rq->req_fds[i];
+	    pfd->revents = sock_poll(pfd->fd) &
+		(pfd->events | POLLERR | POLLHUP | POLLNVAL);
+	    if (pfd->revents)
+		n++;
+	}
+	if (n || sys_time_msec() >= until)
+	    break;
+	thread_wait(&lwip_sockevents, ev, until);
+    }
+    ipc_send(envid, n, rq, PTE_P|PTE_W|PTE_U);
+}
+
+// Interest sets for epoll.  Level-triggered: a wait reports every
+// socket in the set that is ready, starting after where the last one
+// stopped so no socket starves when there are more than fit.
+static struct epset {
+    bool ep_used;
+    uint32_t ep_events[NSMAXSOCKETS];	// 0 for sockets not in the set
+    epoll_data_t ep_data[NSMAXSOCKETS];
+    int ep_next;
+} epsets[NSMAXEPOLL];
+
+static struct epset *
+epset_lookup(int ep) {
+    if (ep < 0 || ep >= NSMAXEPOLL || !epsets[ep].ep_used)
+	return 0;
+    return &epsets[ep];
+}
+
+static void
+serve_epoll_create(envid_t envid) {
+    int ep;
+
+    for (ep = 0; ep < NSMAXEPOLL; ep++)
+	if (!epsets[ep].ep_used)
+	    break;
+    if (ep == NSMAXEPOLL) {
+	ipc_send(envid, -E_NO_MEM, 0, 0);
+	return;
+    }
+    memset(&epsets[ep], 0, sizeof(epsets[ep]));
+    epsets[ep].ep_used = 1;
+    ipc_send(envid, ep, 0, 0);
+}
+
+static void
+serve_epoll_ctl(envid_t envid, struct Nsreq_epoll_ctl *rq) {
+    struct epset *es;
+    int s = rq->req_s, r = 0;
+
+    if (!(es = epset_lookup(rq->req_ep)) || s < 0 || s >= NSMAXSOCKETS
+	|| lwip_sockstate(s) < 0) {
+	r = -E_INVAL;
+	goto out;
+    }
+
+    switch (rq->req_op) {
+    case EPOLL_CTL_ADD:
+    case EPOLL_CTL_MOD:
+	if ((rq->req_op == EPOLL_CTL_ADD) != !es->ep_events[s]) {
+	    r = rq->req_op == EPOLL_CTL_ADD ? -E_FILE_EXISTS : -E_NOT_FOUND;
+	    break;
+	}
+	// Errors and hangups are always of interest; also marks it in the set
+	es->ep_events[s] = rq->req_event.events | EPOLLERR | EPOLLHUP;
+	es->ep_data[s] = rq->req_event.data;
+	break;
+    case EPOLL_CTL_DEL:
+	if (!es->ep_events[s])
+	    r = -E_NOT_FOUND;
+	es->ep_events[s] = 0;
+	break;
+    default:
+	r = -E_INVAL;
+    }
+
+ out:
+    ipc_send(envid, r, 0, 0);
+}
+
+static void
+serve_epoll_wait(envid_t envid, struct Nsreq_epoll_wait *rq) {
+    struct epset *es;
+    struct epoll_event *evs = (struct epoll_event *) rq;
+    uint32_t ev, until, ready;
+    int i, s, n, ep, max;
+
+    ep = rq->req_ep;
+    if (!epset_lookup(ep) || rq->req_maxevents <= 0) {
+	ipc_send(envid, -E_INVAL, 0, 0);
+	return;
+    }
+    max = MIN(rq->req_maxevents, (int) NSMAXEVENTS);
+
+    // The events go over the request, so take what it says first
+    until = poll_deadline(rq->req_timeout);
+    for (;;) {
+	// The set may have gone away while we waited
+	if (!(es = epset_lookup(ep))) {
+	    ipc_send(envid, -E_INVAL, 0, 0);
+	    return;
+	}
+	ev = lwip_sockevents;
+	n = 0;
+	for (i = 0; i < NSMAXSOCKETS && n < max; i++) {
+	    s = (es->ep_next + i) % NSMAXSOCKETS;
+	    if (!es->ep_events[s])
+		continue;
+	    if (!(ready = sock_poll(s) & es->ep_events[s]))
+		continue;
+	    evs[n].events = ready;
+	    evs[n].data = es->ep_data[s];
+	    n++;
+	}
+	if (n) {
+	    es->ep_next = (es->ep_next + i) % NSMAXSOCKETS;
+	    break;
+	}
+	if (sys_time_msec() >= until)
+	    break;
+	thread_wait(&lwip_sockevents, ev, until);
+    }
+    ipc_send(envid, n, rq, PTE_P|PTE_W|PTE_U);
+}
+
+static void
+serve_epoll_close(envid_t envid, struct Nsreq_epoll_close *rq) {
+    struct epset *es;
+
+    if (!(es = epset_lookup(rq->req_ep))) {
+	ipc_send(envid, -E_INVAL, 0, 0);
+	return;
+    }
+    es->ep_used = 0;
+    lwip_sockevents++;	// waiters look again and find it gone
+    ipc_send(envid, 0, 0, 0);
+}
+
+// A closed socket leaves every interest set, as its number may be reused.
+static void
+epoll_forget(int s) {
+    int ep;
+
+    if (s < 0 || s >= NSMAXSOCKETS)
+	return;
+    for (ep = 0; ep < NSMAXEPOLL; ep++)
+	epsets[ep].ep_events[s] = 0;
+}
+
 static void
 serve_close(envid_t envid, struct Nsreq_close* rq) {
-    int r = lwip_close(rq->req_s);
+    int r;
+
+    if (rq->req_s >= 0 && rq->req_s < NSMAXRINGS && rings[rq->req_s].sr_ring)
+	ring_free(rq->req_s);
+    epoll_forget(rq->req_s);
+    r = lwip_close(rq->req_s);
     if (r < 0) perror("serve_close");
     ipc_send(envid, r, 0, 0);
 }
@@ -208,23 +643,96 @@ serve_listen(envid_t envid, struct Nsreq_listen* rq) {
     ipc_send(envid, r, 0, 0);
 }
 
+// A short receive comes back in the request page itself; a long one
+// goes straight into the caller's pages.  lwip_recv takes less than
+// 64KB a call, so those are filled with as many as it takes, waiting
+// only for the first.
 static void
 serve_recv(envid_t envid, struct Nsreq_recv* rq) {
-    int r;
-    void *mem;
-    extern uint8_t nsipcbuf[PGSIZE];	// page-aligned, declared in entry.S
+    int r, n, s, len, flags;
+    char *mem;
+
+    s = rq->req_s;
+    len = rq->req_len;
+    flags = rq->req_flags;
 
-    mem = (void *)nsipcbuf;
-    r = lwip_recv(rq->req_s, mem, rq->req_len, rq->req_flags);
-    if (r < 0) perror("serve_recv");
+    if (rq->req_npages == 0) {
+	r = lwip_recv(s, rq, MIN(len, PGSIZE), flags);
+	if (r < 0) perror("serve_recv");
+	ipc_send(envid, r, rq, PTE_P|PTE_W|PTE_U);
+	return;
+    }
 
-    ipc_send(envid, r, mem, PTE_P|PTE_W|PTE_U);
+    if (!(mem = lent_data(rq, rq->req_offset, len, rq->req_npages))) {
+	r = -E_INVAL;
+	goto out;
+    }
+    n = 0;
+    do {
+	r = lwip_recv(s, mem + n, MIN(len - n, 0x8000),
+		      flags | (n ? MSG_DONTWAIT : 0));
+	if (r > 0)
+	    n += r;
+    } while (r > 0 && n < len && !(flags & MSG_PEEK));
+    if (n > 0)
+	r = n;
+    else if (r < 0)
+	perror("serve_recv");
+
+ out:
+    unmap_lent(rq);
+    ipc_send(envid, r, 0, 0);
 }
 
 static void
 serve_send(envid_t envid, struct Nsreq_send* rq) {
-    int r = lwip_send(rq->req_s, &rq->req_dataptr, rq->req_size, rq->req_flags);
-    if (r < 0) perror("serve_send");
+    int r;
+    char *data;
+
+    if (rq->req_size < 0)
+	data = 0;
+    else if (rq->req_npages == 0)
+	data = rq->req_size <= (int) NSMAXINLINE ? rq->req_dataptr : 0;
+    else
+	data = lent_data(rq, rq->req_offset, rq->req_size, rq->req_npages);
+    if (!data)
+	r = -E_INVAL;
+    else if ((r = lwip_send(rq->req_s, data, rq->req_size, rq->req_flags)) < 0)
+	perror("serve_send");
+    if (rq->req_npages)
+	unmap_lent(rq);
+    ipc_send(envid, r, 0, 0);
+}
+
+// Send file pages mapped in after the request page.  TCP queues them by
+// reference, so the reply waits until the peer has acknowledged them all
+// and the pages can be let go.  The thread sleeps between acks; timers
+// may also drop the connection, so it looks again every slow TCP tick.
+static void
+serve_sendfile(envid_t envid, struct Nsreq_sendfile *rq) {
+    int r;
+    struct lwip_nocopy nc;
+    uint32_t ev;
+    char *data;
+
+    data = lent_data(rq, rq->req_offset, rq->req_size,
+		     MIN(rq->req_npages, NSMAXSENDPAGES));
+    if (!data) {
+	r = -E_INVAL;
+	goto out;
+    }
+
+    r = lwip_send_nocopy(rq->req_s, data, rq->req_size, &nc);
+    if (r < 0) perror("serve_sendfile");
+    for (;;) {
+	ev = tcp_ackevents;
+	if (lwip_nocopy_done(&nc))
+	    break;
+	thread_wait(&tcp_ackevents, ev, sys_time_msec() + TCP_SLOW_INTERVAL);
+    }
+
+ out:
+    unmap_lent(rq);
     ipc_send(envid, r, 0, 0);
 }
 
@@ -245,6 +753,7 @@ process_timer(envid_t envid) {
     }
 
     start = sys_time_msec();
+    rings_poll();	// for data the TCP timers handed up
     thread_yield();
     now = sys_time_msec();
 
@@ -252,10 +761,54 @@ process_timer(envid_t envid) {
     ipc_send(envid, to, 0, 0);
 }
 
+// A batch of frames from the input env, each in the page the NIC
+// received it into.  jif maps the pages it keeps elsewhere; each page
+// leaves the slot once jif has seen it, so a later request into the slot
+// cannot reach a frame the stack still holds.  Frames sent in answer go
+// out together once the core is unlocked.
+static void
+net_recv(envid_t envid, struct Nsreq_input *req) {
+    char *va;
+    int i, n;
+
+    n = MIN(req->req_npkts, bpages[buffer_index(req)] - 1);
+    lwip_core_lock();
+    for (i = 0; i < n; i++) {
+	va = (char *)req + (i + 1) * PGSIZE;
+	jif_input(&nif, va);
+	sys_page_unmap(0, va);
+    }
+    lwip_core_unlock();
+    rings_poll();
+}
+
+// With NS_RING the input env only tells us frames have come in; they are
+// in the NIC rings.
 static void
-net_recv(envid_t envid, struct jif_pkt* pkt) {
-    jif_input(&nif, (void *)pkt);
-    sys_page_unmap(0, (void*)pkt);
+net_poll(void) {
+    lwip_core_lock();
+    jif_poll(&nif);
+    lwip_core_unlock();
+    rings_poll();
+}
+
+// With NS_SINGLE, take whatever frames are waiting off the NIC ourselves.
+// The pages stay mapped until the next batch replaces them.
+static void
+net_input(void) {
+    int i, n;
+
+    if (NS_RING) {
+	net_poll();
+	return;
+    }
+    if ((n = sys_nic_recv_pages_nb((void *)INPUTVA, NSMAXSENDPAGES)) > 0) {
+	lwip_core_lock();
+	for (i = 0; i < n; i++)
+	    jif_input(&nif, (void *)(INPUTVA + i * PGSIZE));
+	lwip_core_unlock();
+    }
+    rings_poll();	// also for data the TCP timers handed up
 }
 
 struct st_args {
@@ -296,8 +849,32 @@ serve_thread(uint32_t a) {
 	  case NSREQ_SOCKET:
 		serve_socket(args->whom, (struct Nsreq_socket*)args->va);
 		break;
+	  case NSREQ_SENDFILE:
+		serve_sendfile(args->whom, (struct Nsreq_sendfile*)args->va);
+		break;
 	  case NSREQ_INPUT:
-		net_recv(args->whom, (struct jif_pkt*)args->va);
+		net_recv(args->whom, (struct Nsreq_input*)args->va);
+		break;
+	  case NSREQ_RING:
+		serve_ring(args->whom, (struct Nsreq_ring*)args->va);
+		break;
+	  case NSREQ_RINGWAIT:
+		serve_ringwait(args->whom, (struct Nsreq_ringwait*)args->va);
+		break;
+	  case NSREQ_POLL:
+		serve_poll(args->whom, (struct Nsreq_poll*)args->va);
+		break;
+	  case NSREQ_EPOLL_CREATE:
+		serve_epoll_create(args->whom);
+		break;
+	  case NSREQ_EPOLL_CTL:
+		serve_epoll_ctl(args->whom, (struct Nsreq_epoll_ctl*)args->va);
+		break;
+	  case NSREQ_EPOLL_WAIT:
+		serve_epoll_wait(args->whom, (struct Nsreq_epoll_wait*)args->va);
+		break;
+	  case NSREQ_EPOLL_CLOSE:
+		serve_epoll_close(args->whom, (struct Nsreq_epoll_close*)args->va);
 		break;
 	  default:
 		cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
@@ -308,6 +885,32 @@ serve_thread(uint32_t a) {
 	sys_page_unmap(0, (void*) args->va);
 }
 
+// Receive the next request into va.  With NS_SINGLE there are no input
+// and timer envs: while the receive is pending we take frames off the NIC
+// between rounds of the threads, and once all of them are waiting the
+// env sleeps until a request or a frame comes in, or the soonest of the
+// waits times out.
+static int32_t
+recv_request(uint32_t *whom, void *va, int *perm) {
+	uint32_t to;
+	int r;
+
+	if (!NS_SINGLE)
+		return ipc_recv_pages((int32_t *) whom, va, SLOTPAGES, perm);
+
+	if ((r = sys_ipc_recv_pages_nb(va, SLOTPAGES)) < 0)
+		panic("serve: cannot receive: %e", r);
+	while (env->env_ipc_recving) {
+		net_input();
+		if ((to = thread_wait_deadline()) != 0)
+			sys_ipc_wait_until(to, 1);
+		thread_yield();
+	}
+	*whom = env->env_ipc_from;
+	*perm = env->env_ipc_perm;
+	return env->env_ipc_value;
+}
+
 void
 serve(void) {
 	int32_t req;
@@ -318,7 +921,8 @@ serve(void) {
 	while (1) {
 		perm = 0;
 		va = get_buffer();
-		req = ipc_recv((int32_t *) &whom, (void *) va, &perm);
+		req = recv_request(&whom, va, &perm);
+		bpages[buffer_index(va)] = env->env_ipc_npages;
 		if (debug) {
 			cprintf("ns req %d from %08x [page %08x: %s]\n",
 				req, whom, vpt[VPN(va)], va);
@@ -330,6 +934,17 @@ serve(void) {
 			process_timer(whom);
 			put_buffer(va);
 			continue;
+		case NSREQ_INPUT:
+			if (!NS_RING)
+				break;
+			net_poll();
+			put_buffer(va);
+			continue;
+		case NSREQ_RINGKICK:
+			rings_poll();
+			thread_yield();	// and ring_tx look
+			put_buffer(va);
+			continue;
 #define SHELL 1234
 		case SHELL:	/* Makeshift: Avoid shell scratching the Screen */
 			ipc_send(whom, SHELL, 0, 0);
@@ -374,33 +989,28 @@ umain(void)
 
         binaryname = "ns";
 
-	// fork off the timer thread which will send us periodic messages
-	timer_envid = fork();
-	if (timer_envid < 0)
-		panic("error forking");
-	else if (timer_envid == 0) {
-		timer(ns_envid, TIMER_INTERVAL);
-		return;
-	}
-	// fork off the input thread which will pool the NIC driver for input
-	// packets
-	input_envid = fork();
-	if (input_envid < 0)
-		panic("error forking");
-	else if (input_envid == 0) {
-		input(ns_envid);
-		return;
+	// With NS_SINGLE our own threads do what these do; see recv_request
+	if (!NS_SINGLE) {
+		// fork off the timer thread which will send us periodic messages
+		timer_envid = fork();
+		if (timer_envid < 0)
+			panic("error forking");
+		else if (timer_envid == 0) {
+			timer(ns_envid, TIMER_INTERVAL);
+			return;
+		}
+		// fork off the input thread which will pool the NIC driver for
+		// input packets
+		input_envid = fork();
+		if (input_envid < 0)
+			panic("error forking");
+		else if (input_envid == 0) {
+			input(ns_envid);
+			return;
+		}
 	}
 
-	// fork off the output thread that will send the packets to the NIC
-	// driver
-	output_envid = fork();
-	if (output_envid < 0)
-		panic("error forking");
-	else if (output_envid == 0) {
-		output(ns_envid);
-		return;
-	}
+	// There is no output env: the NIC sends straight out of our pbufs
 
 	// lwIP requires a user threading library; start the library and jump
 	// into a thread to continue initialization. 
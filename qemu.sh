@@ -1,7 +1,12 @@
 #!/bin/bash
 
-qemu -hda obj/kern/bochs.img -hdb obj/fs/fs.img -parallel stdio \
+# Further members of a striped or mirrored file system go on the
+# secondary IDE channel (see fsformat -s/-m)
+DISKS=
+[ -f obj/fs/fs.img.1 ] && DISKS="$DISKS -hdc obj/fs/fs.img.1"
+[ -f obj/fs/fs.img.2 ] && DISKS="$DISKS -hdd obj/fs/fs.img.2"
+
+qemu -hda obj/kern/bochs.img -hdb obj/fs/fs.img $DISKS -parallel stdio \
      -smp 4 -no-kqemu -name kludgeOS \
      -net user -net nic,model=i82559er,macaddr=52:54:00:12:34:56 \
      -redir tcp:8080::80 -redir tcp:4242::10000 "$@" -std-vga
-
@@ -0,0 +1,328 @@
+// File server benchmark.  Times open/close and stat requests, sequential
+// and random reads and writes, several clients reading at once, and
+// creates, lookups and removes in a large directory, then prints the
+// latency histograms the server keeps for each request type.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define BENCHFILE	"/fsbench.dat"
+#define BENCHDIR	"/fsbench.dir"
+#define CHUNK		(8 * PGSIZE)
+#define MAXCLIENTS	32
+
+static uint8_t buf[CHUNK];
+static int nops = 1000;
+static int filesize = 1024 * 1024;
+static int nclients = 4;
+static int nfiles = 1000;
+static uint32_t seed = 1;
+static struct FsLatency lat[NFSREQ];
+
+static const char *reqname[NFSREQ] = {
+	[FSREQ_OPEN]		"open",
+	[FSREQ_MAP]		"map",
+	[FSREQ_SET_SIZE]	"set_size",
+	[FSREQ_CLOSE]		"close",
+	[FSREQ_DIRTY]		"dirty",
+	[FSREQ_REMOVE]		"remove",
+	[FSREQ_SYNC]		"sync",
+	[FSREQ_MAP_RANGE]	"map_range",
+	[FSREQ_STAT]		"stat",
+	[FSREQ_READDIR]		"readdir",
+	[FSREQ_PREALLOC]	"prealloc",
+};
+
+static uint32_t
+rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void
+report(const char *what, unsigned t0, int n, const char *unit)
+{
+	unsigned ms = sys_time_msec() - t0;
+
+	if (ms == 0)
+		ms = 1;
+	cprintf("%-12s %8d %s in %5u ms: %8u %s/s\n",
+		what, n, unit, ms, (unsigned) ((uint64_t) n * 1000 / ms), unit);
+}
+
+static int
+openbench(int mode)
+{
+	int fd;
+
+	if ((fd = open(BENCHFILE, mode)) < 0)
+		panic("open %s: %e", BENCHFILE, fd);
+	return fd;
+}
+
+void
+bench_openclose(void)
+{
+	unsigned t0;
+	int i;
+
+	t0 = sys_time_msec();
+	for (i = 0; i < nops; i++)
+		close(openbench(O_RDONLY));
+	report("open/close", t0, nops, "ops");
+}
+
+// Goes straight to the server: stat() would mostly hit the client's
+// stat cache.
+void
+bench_stat(void)
+{
+	struct Stat st;
+	unsigned t0;
+	int i, r;
+
+	t0 = sys_time_msec();
+	for (i = 0; i < nops; i++)
+		if ((r = fsipc_stat(BENCHFILE, &st)) < 0)
+			panic("stat %s: %e", BENCHFILE, r);
+	report("stat", t0, nops, "ops");
+}
+
+void
+bench_seqwrite(void)
+{
+	unsigned t0;
+	int fd, n, r;
+
+	t0 = sys_time_msec();
+	fd = openbench(O_RDWR|O_CREAT|O_TRUNC);
+	for (n = 0; n < filesize; n += r) {
+		memset(buf, n / CHUNK, CHUNK);
+		if ((r = write(fd, buf, MIN(CHUNK, filesize - n))) <= 0)
+			panic("write: %e", r);
+	}
+	close(fd);
+	sync();
+	report("seq write", t0, filesize / 1024, "KB");
+}
+
+static void
+seqread(void)
+{
+	int fd, n, r;
+
+	fd = openbench(O_RDONLY);
+	for (n = 0; n < filesize; n += r)
+		if ((r = read(fd, buf, CHUNK)) <= 0)
+			panic("read: %e", r);
+	close(fd);
+}
+
+void
+bench_seqread(void)
+{
+	unsigned t0;
+
+	t0 = sys_time_msec();
+	seqread();
+	report("seq read", t0, filesize / 1024, "KB");
+}
+
+void
+bench_random(bool writing)
+{
+	unsigned t0;
+	int fd, i, r;
+	off_t off;
+
+	t0 = sys_time_msec();
+	fd = openbench(writing ? O_RDWR : O_RDONLY);
+	for (i = 0; i < nops; i++) {
+		off = (rand() % (filesize / BLKSIZE)) * BLKSIZE;
+		seek(fd, off);
+		if (writing)
+			r = write(fd, buf, BLKSIZE);
+		else
+			r = read(fd, buf, BLKSIZE);
+		if (r != BLKSIZE)
+			panic("%s at %d: %e", writing ? "write" : "read", off, r);
+	}
+	close(fd);
+	if (writing)
+		sync();
+	report(writing ? "rand write" : "rand read", t0, nops, "ops");
+}
+
+// Every client reads the whole file.
+void
+bench_clients(void)
+{
+	envid_t kids[MAXCLIENTS];
+	unsigned t0;
+	int i;
+
+	t0 = sys_time_msec();
+	for (i = 0; i < nclients; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0) {
+			seqread();
+			exit();
+		}
+	}
+	for (i = 0; i < nclients; i++)
+		wait(kids[i]);
+	report("clients", t0, nclients * filesize / 1024, "KB");
+}
+
+// Creates, looks up in a scattered order, and removes nfiles files in one
+// directory: exercises the server's directory index and lookup cache.
+void
+bench_dir(void)
+{
+	char path[MAXPATHLEN];
+	struct Stat st;
+	unsigned t0;
+	int i, fd, r;
+
+	if ((fd = open(BENCHDIR, O_RDONLY|O_CREAT|O_MKDIR)) < 0)
+		panic("mkdir %s: %e", BENCHDIR, fd);
+	close(fd);
+
+	t0 = sys_time_msec();
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), BENCHDIR "/f%d", i);
+		if ((fd = open(path, O_RDWR|O_CREAT)) < 0)
+			panic("create %s: %e", path, fd);
+		close(fd);
+	}
+	report("dir create", t0, nfiles, "ops");
+
+	t0 = sys_time_msec();
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), BENCHDIR "/f%u",
+			 (i * 7919U) % nfiles);
+		if ((r = fsipc_stat(path, &st)) < 0)
+			panic("stat %s: %e", path, r);
+	}
+	if (fsipc_stat(BENCHDIR "/missing", &st) != -E_NOT_FOUND)
+		panic("stat %s/missing succeeded", BENCHDIR);
+	report("dir lookup", t0, nfiles, "ops");
+
+	t0 = sys_time_msec();
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), BENCHDIR "/f%d", i);
+		if ((r = remove(path)) < 0)
+			panic("remove %s: %e", path, r);
+	}
+	if ((r = remove(BENCHDIR)) < 0)
+		panic("remove %s: %e", BENCHDIR, r);
+	report("dir remove", t0, nfiles, "ops");
+}
+
+void
+print_stats(void)
+{
+	struct FsLatency *fl;
+	uint64_t tsc;
+	unsigned t0, mhz;
+	int i, j, r;
+
+	// Cycles per microsecond, to turn latencies into time
+	t0 = sys_time_msec();
+	while (sys_time_msec() == t0)
+		;
+	tsc = read_tsc();
+	t0 += 101;
+	while (sys_time_msec() < t0)
+		;
+	mhz = (read_tsc() - tsc) / 100000;
+	if (mhz == 0)
+		mhz = 1;
+
+	if ((r = fsipc_stats(lat, 0)) < 0)
+		panic("fsipc_stats: %e", r);
+
+	cprintf("\n%-10s %8s %8s %8s   latency histogram (us: count)\n",
+		"request", "count", "avg us", "max us");
+	for (i = 0; i < NFSREQ; i++) {
+		fl = &lat[i];
+		if (fl->fl_count == 0 || !reqname[i])
+			continue;
+		cprintf("%-10s %8u %8u %8u  ", reqname[i], fl->fl_count,
+			(unsigned) (fl->fl_total / fl->fl_count / mhz),
+			fl->fl_max / mhz);
+		for (j = 0; j < NFSLAT - 1; j++)
+			if (fl->fl_hist[j])
+				cprintf(" <%u:%u", (1U << (FSLAT_SHIFT + j)) / mhz,
+					fl->fl_hist[j]);
+		if (fl->fl_hist[j])
+			cprintf(" >%u:%u", (1U << (FSLAT_SHIFT + j - 1)) / mhz,
+				fl->fl_hist[j]);
+		cprintf("\n");
+	}
+}
+
+void
+usage(void)
+{
+	cprintf("usage: fsbench [-n ops] [-s kbytes] [-c clients] [-d files]\n");
+	exit();
+}
+
+static int
+numarg(char *s)
+{
+	long n;
+	char *end;
+
+	if (!s)
+		usage();
+	n = strtol(s, &end, 0);
+	if (*end || n <= 0)
+		usage();
+	return n;
+}
+
+void
+umain(int argc, char **argv)
+{
+	int r;
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'n':
+		nops = numarg(ARGF());
+		break;
+	case 's':
+		filesize = numarg(ARGF()) * 1024;
+		break;
+	case 'c':
+		nclients = MIN(numarg(ARGF()), MAXCLIENTS);
+		break;
+	case 'd':
+		nfiles = numarg(ARGF());
+		break;
+	}ARGEND
+
+	filesize = ROUNDUP(filesize, BLKSIZE);
+	memset(buf, 0, sizeof(buf));
+
+	// Count only what the benchmark itself does
+	if ((r = fsipc_stats(lat, 1)) < 0)
+		panic("fsipc_stats: %e", r);
+
+	bench_seqwrite();
+	bench_seqread();
+	bench_openclose();
+	bench_stat();
+	bench_random(0);
+	bench_random(1);
+	bench_clients();
+	bench_dir();
+	print_stats();
+
+	remove(BENCHFILE);
+}
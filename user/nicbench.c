@@ -0,0 +1,188 @@
+// NIC packets-per-second benchmark.  Sends minimum-size frames (ARP
+// requests for the QEMU gateway, so they draw replies) through each of
+// the NIC interfaces in turn: one trap per frame, one per batch, and the
+// rings mapped straight in, where only the doorbell traps.  The ring run
+// also counts the replies it reads off the receive slots.  ns cannot use
+// the NIC meanwhile; if it maps the rings itself (NS_RING), it is the
+// benchmark that cannot.
+
+#include <inc/lib.h>
+
+#define RINGVA		0x10000000
+#define MAXFRAMES	(1 << 24)
+
+static int nframes = 100000;
+static char *mode;
+
+// who-has 10.0.2.2 tell 10.0.2.15, padded to the 60-byte minimum
+static const uint8_t frame[60] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff,	// broadcast
+	0x52, 0x54, 0x00, 0x12, 0x34, 0x56,	// from us
+	0x08, 0x06,				// ARP
+	0x00, 0x01, 0x08, 0x00, 6, 4, 0x00, 0x01,
+	0x52, 0x54, 0x00, 0x12, 0x34, 0x56, 10, 0, 2, 15,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 10, 0, 2, 2,
+};
+
+static unsigned t0;
+static struct nic_stats st0;
+
+static void
+start(void)
+{
+	sys_nic_stats(&st0);
+	t0 = sys_time_msec();
+}
+
+static void
+report(const char *what, int n)
+{
+	struct nic_stats st;
+	unsigned ms;
+
+	// Count the frames only once the NIC is done with them
+	do
+		sys_nic_stats(&st);
+	while (st.tx_done != st.tx_queued);
+	ms = sys_time_msec() - t0;
+	if (ms == 0)
+		ms = 1;
+	cprintf("%-6s %8d frames in %5u ms: %8u frames/s, CBL full %u times\n",
+		what, n, ms, (unsigned) ((uint64_t) n * 1000 / ms),
+		st.tx_drops - st0.tx_drops);
+}
+
+// One trap, and one copy, per frame
+void
+bench_send(void)
+{
+	int n, r;
+
+	start();
+	for (n = 0; n < nframes; )
+		if ((r = sys_nic_send((char *) frame, sizeof(frame))) == 0)
+			n++;
+		else if (r == -E_BAD_ENV) {
+			cprintf("send: the rings are mapped elsewhere\n");
+			return;
+		}
+	report("send", n);
+}
+
+// One trap for a page full of frames
+void
+bench_batch(void)
+{
+	static struct nic_frame batch[NIC_MAXBATCH];
+	struct nic_txstat st;
+	int i, n, r;
+
+	for (i = 0; i < NIC_MAXBATCH; i++) {
+		batch[i].nf_nseg = 1;
+		batch[i].nf_seg[0].ns_va = frame;
+		batch[i].nf_seg[0].ns_len = sizeof(frame);
+	}
+	start();
+	for (n = 0; n < nframes; n += r)
+		if ((r = sys_nic_send_batch(batch, MIN(NIC_MAXBATCH, nframes - n),
+					    &st)) < 0) {
+			cprintf("batch: %e\n", r);
+			return;
+		}
+	report("batch", n);
+}
+
+// Frames the NIC received into the ring since the last look
+static int
+ring_drain(struct nic_ring *ring, uint32_t *slot, uint32_t synced)
+{
+	int n;
+
+	for (n = 0; ring->nr_rxcons - synced < ring->nr_nrx &&
+		     nic_ring_rxlen(ring->nr_rxbuf + *slot * PGSIZE) >= 0; n++) {
+		*slot = (*slot + 1) % ring->nr_nrx;
+		ring->nr_rxcons++;
+	}
+	return n;
+}
+
+// Fill every free transmit slot, then ring the doorbell once
+void
+bench_ring(void)
+{
+	struct nic_ring *ring = (struct nic_ring *) RINGVA;
+	uint32_t i, rxslot, rxsynced;
+	int n, nrx, r;
+
+	if ((r = sys_nic_ring_map(ring)) < 0) {
+		cprintf("ring: cannot map the rings: %e\n", r);
+		return;
+	}
+	for (i = 0; i < ring->nr_ntx; i++) {
+		memmove(ring->nr_txbuf + i * NIC_RING_BUFSZ, frame, sizeof(frame));
+		ring->nr_txlen[i] = sizeof(frame);
+	}
+	rxslot = ring->nr_rxfirst;
+	rxsynced = 0;
+	nrx = 0;
+
+	start();
+	for (n = 0; n < nframes; ) {
+		// Every buffer holds the frame already
+		while (n < nframes &&
+		       ring->nr_txprod - ring->nr_txcons < ring->nr_ntx) {
+			ring->nr_txprod++;
+			n++;
+		}
+		nrx += ring_drain(ring, &rxslot, rxsynced);
+		if ((r = sys_nic_ring_sync()) < 0)
+			panic("ring sync: %e", r);
+		rxsynced = ring->nr_rxcons;
+	}
+	report("ring", n);
+	cprintf("ring: %d frames received\n", nrx);
+}
+
+void
+usage(void)
+{
+	cprintf("usage: nicbench [-n frames] [-m send|batch|ring]\n");
+	exit();
+}
+
+static int
+numarg(char *s)
+{
+	long n;
+	char *end;
+
+	if (!s)
+		usage();
+	n = strtol(s, &end, 0);
+	if (*end || n <= 0)
+		usage();
+	return n;
+}
+
+void
+umain(int argc, char **argv)
+{
+	ARGBEGIN{
+	default:
+		usage();
+	case 'n':
+		nframes = MIN(numarg(ARGF()), MAXFRAMES);
+		break;
+	case 'm':
+		if (!(mode = ARGF()))
+			usage();
+		break;
+	}ARGEND
+
+	if (!mode || strcmp(mode, "send") == 0)
+		bench_send();
+	if (!mode || strcmp(mode, "batch") == 0)
+		bench_batch();
+	if (!mode || strcmp(mode, "ring") == 0)
+		bench_ring();
+}
@@ -0,0 +1,177 @@
+// Checks poll, select and epoll_wait against the network server: that
+// they time out when nothing is ready, and report a pending connection,
+// a writable socket and incoming data when something is.  The second
+// half needs a client on PORT (4242 on the host, see qemu.sh) that sends
+// a line, e.g.
+//	echo hello | nc localhost 4242
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define PORT		10000
+#define TIMEOUT		300	// msec
+#define SLACK		10	// msec the clock may be behind
+
+static unsigned t0;
+
+static void
+start(void)
+{
+	t0 = sys_time_msec();
+}
+
+static void
+check_timeout(const char *what, int r)
+{
+	unsigned ms = sys_time_msec() - t0;
+
+	if (r != 0)
+		panic("%s: %d ready, expected a timeout", what, r);
+	if (ms + SLACK < TIMEOUT)
+		panic("%s: timed out after %u ms, expected %d", what, ms, TIMEOUT);
+	cprintf("%s: timed out after %u ms\n", what, ms);
+}
+
+// Nothing connects to srv yet, so every wait for it has to time out.
+static void
+test_timeouts(int srv, int ep)
+{
+	struct pollfd pfd;
+	struct epoll_event ev;
+	struct timeval tv;
+	fd_set rset;
+	int r;
+
+	pfd.fd = srv;
+	pfd.events = POLLIN;
+	start();
+	r = poll(&pfd, 1, TIMEOUT);
+	check_timeout("poll", r);
+
+	FD_ZERO(&rset);
+	FD_SET(srv, &rset);
+	tv.tv_sec = 0;
+	tv.tv_usec = TIMEOUT * 1000;
+	start();
+	r = select(srv + 1, &rset, 0, 0, &tv);
+	check_timeout("select", r);
+	if (FD_ISSET(srv, &rset))
+		panic("select: left the listening socket in the read set");
+
+	start();
+	r = epoll_wait(ep, &ev, 1, TIMEOUT);
+	check_timeout("epoll_wait", r);
+
+	// A zero timeout only looks
+	start();
+	if ((r = poll(&pfd, 1, 0)) != 0 || sys_time_msec() - t0 > TIMEOUT / 2)
+		panic("poll with no timeout: %d", r);
+}
+
+static void
+test_errors(int ep)
+{
+	struct pollfd pfd;
+	struct epoll_event ev;
+	int r;
+
+	pfd.fd = -1;
+	pfd.events = POLLIN;
+	if ((r = poll(&pfd, 1, 0)) != 1 || !(pfd.revents & POLLNVAL))
+		panic("poll on no socket: %d, revents %x", r, pfd.revents);
+	if ((r = epoll_wait(ep, &ev, 0, 0)) != -E_INVAL)
+		panic("epoll_wait with maxevents 0: %e", r);
+	if ((r = epoll_wait(ep, &ev, -1, 0)) != -E_INVAL)
+		panic("epoll_wait with maxevents -1: %e", r);
+	cprintf("bad sockets and event counts are refused\n");
+}
+
+// Waits for a client, then for the line it sends.
+static void
+test_ready(int srv, int ep)
+{
+	struct sockaddr_in client;
+	socklen_t clientlen;
+	struct epoll_event ev;
+	struct pollfd pfd;
+	fd_set rset, wset;
+	char buf[64];
+	int sock, r;
+
+	cprintf("waiting for a client on port %d\n", PORT);
+	pfd.fd = srv;
+	pfd.events = POLLIN;
+	if ((r = poll(&pfd, 1, -1)) != 1 || !(pfd.revents & POLLIN))
+		panic("poll for a connection: %d, revents %x", r, pfd.revents);
+	clientlen = sizeof(client);
+	if ((sock = accept(srv, (struct sockaddr *) &client, &clientlen)) < 0)
+		panic("accept: %e", sock);
+	cprintf("poll: connection from %s\n", inet_ntoa(client.sin_addr));
+
+	FD_ZERO(&wset);
+	FD_SET(sock, &wset);
+	if ((r = select(sock + 1, 0, &wset, 0, 0)) != 1 || !FD_ISSET(sock, &wset))
+		panic("select for writing: %d", r);
+	cprintf("select: new connection is writable\n");
+
+	ev.events = EPOLLIN;
+	ev.data.fd = sock;
+	if ((r = epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev)) < 0)
+		panic("epoll_ctl: %e", r);
+	memset(&ev, 0, sizeof(ev));
+	if ((r = epoll_wait(ep, &ev, 1, -1)) != 1)
+		panic("epoll_wait for data: %d", r);
+	if (ev.data.fd != sock || !(ev.events & EPOLLIN))
+		panic("epoll_wait: event %x for %d, expected EPOLLIN for %d",
+		      ev.events, ev.data.fd, sock);
+	cprintf("epoll_wait: data ready\n");
+
+	FD_ZERO(&rset);
+	FD_SET(sock, &rset);
+	if ((r = select(sock + 1, &rset, 0, 0, 0)) != 1 || !FD_ISSET(sock, &rset))
+		panic("select for reading: %d", r);
+	if ((r = recv(sock, buf, sizeof(buf) - 1, 0)) <= 0)
+		panic("recv: %e", r);
+	buf[r] = 0;
+	cprintf("read %d bytes: %s", r, buf);
+
+	epoll_ctl(ep, EPOLL_CTL_DEL, sock, 0);
+	closesocket(sock);
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	struct epoll_event ev;
+	int srv, ep, r;
+
+	if ((srv = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		panic("socket: %e", srv);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(PORT);
+	if (bind(srv, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		panic("bind failed");
+	if (listen(srv, 1) < 0)
+		panic("listen failed");
+
+	if ((ep = epoll_create(1)) < 0)
+		panic("epoll_create: %e", ep);
+	ev.events = EPOLLIN;
+	ev.data.fd = srv;
+	if ((r = epoll_ctl(ep, EPOLL_CTL_ADD, srv, &ev)) < 0)
+		panic("epoll_ctl: %e", r);
+
+	test_timeouts(srv, ep);
+	test_errors(ep);
+	if ((r = epoll_ctl(ep, EPOLL_CTL_DEL, srv, 0)) < 0)
+		panic("epoll_ctl: %e", r);
+	test_ready(srv, ep);
+
+	epoll_close(ep);
+	closesocket(srv);
+	cprintf("testpoll: OK\n");
+}
@@ -0,0 +1,117 @@
+// Network transmit benchmark.  Waits for a client on PORT (4242 on the
+// host, see qemu.sh), streams it data as fast as the stack takes it and
+// reports the throughput and what the NIC counted meanwhile, e.g. with
+//	nc localhost 4242 >/dev/null
+// With -r the socket sends through rings shared with ns; see sockring.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define PORT		10000
+#define MAXBUF		(16 * 1024)
+
+static char buf[MAXBUF];
+static int total = 4 * 1024 * 1024;
+static int bufsize = 4096;
+static int nrounds = 1;
+static bool ringed;
+
+static void
+stream(int sock)
+{
+	struct nic_stats st0, st;
+	unsigned t0, ms;
+	int n, r;
+
+	sys_nic_stats(&st0);
+	t0 = sys_time_msec();
+	for (n = 0; n < total; n += r)
+		if ((r = send(sock, buf, MIN(bufsize, total - n), 0)) <= 0) {
+			cprintf("send: %e\n", r);
+			break;
+		}
+	ms = sys_time_msec() - t0;
+	if (ms == 0)
+		ms = 1;
+	cprintf("%8d KB in %5u ms: %8u KB/s, %d-byte sends\n", n / 1024, ms,
+		(unsigned) ((uint64_t) n * 1000 / 1024 / ms), bufsize);
+
+	sys_nic_stats(&st);
+	cprintf("nic: %u frames sent, %u dropped; %u received, %u overruns\n",
+		st.tx_done - st0.tx_done, st.tx_drops - st0.tx_drops,
+		st.rx_frames - st0.rx_frames, st.rx_overruns - st0.rx_overruns);
+}
+
+void
+usage(void)
+{
+	cprintf("usage: txbench [-r] [-s kbytes] [-b bufsize] [-n rounds]\n");
+	exit();
+}
+
+static int
+numarg(char *s)
+{
+	long n;
+	char *end;
+
+	if (!s)
+		usage();
+	n = strtol(s, &end, 0);
+	if (*end || n <= 0)
+		usage();
+	return n;
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct sockaddr_in addr, client;
+	socklen_t clientlen;
+	int srv, sock, i, r;
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 's':
+		total = numarg(ARGF()) * 1024;
+		break;
+	case 'b':
+		bufsize = MIN(numarg(ARGF()), MAXBUF);
+		break;
+	case 'n':
+		nrounds = numarg(ARGF());
+		break;
+	case 'r':
+		ringed = 1;
+		break;
+	}ARGEND
+
+	for (i = 0; i < MAXBUF; i++)
+		buf[i] = 'a' + i % 26;
+
+	if ((srv = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		panic("socket: %e", srv);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(PORT);
+	if (bind(srv, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		panic("bind failed");
+	if (listen(srv, 1) < 0)
+		panic("listen failed");
+
+	cprintf("txbench: waiting on port %d\n", PORT);
+	for (i = 0; i < nrounds; i++) {
+		clientlen = sizeof(client);
+		if ((sock = accept(srv, (struct sockaddr *) &client, &clientlen)) < 0)
+			panic("accept: %e", sock);
+		cprintf("txbench: client %s\n", inet_ntoa(client.sin_addr));
+		if (ringed && (r = sockring(sock)) < 0)
+			panic("sockring: %e", r);
+		stream(sock);
+		closesocket(sock);
+	}
+	closesocket(srv);
+}